@@ -0,0 +1,105 @@
+/*
+	arena.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// allocations are aligned for any pointer or integer type
+#define ARENAALIGN sizeof(void *)
+
+
+struct arena *arena_new() {
+
+	struct arena *arena = calloc(1, sizeof(struct arena));
+
+	if (arena == NULL) {
+		printf("Failed to allocate memory!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return(arena);
+}
+
+
+// hands out size bytes of uninitialized memory
+static void *arena_bump(struct arena *arena, size_t size) {
+
+	struct arenachunk *chunk = arena->chunks;
+	size_t chunksize;
+	void *p;
+
+	size = (size + ARENAALIGN - 1) & ~(ARENAALIGN - 1);
+
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		chunksize = size > ARENACHUNK / 4 ? size : ARENACHUNK;
+		chunk = malloc(sizeof(struct arenachunk) + chunksize);
+		if (chunk == NULL) {
+			printf("Failed to allocate memory!\n");
+			exit(EXIT_FAILURE);
+		}
+		chunk->size = chunksize;
+		chunk->used = 0;
+		arena->allocated += sizeof(struct arenachunk) + chunksize;
+
+		if (arena->chunks != NULL && chunksize == size) {
+			// an oversized block; keep filling the current chunk afterwards
+			chunk->next = arena->chunks->next;
+			arena->chunks->next = chunk;
+		} else {
+			chunk->next = arena->chunks;
+			arena->chunks = chunk;
+		}
+	}
+
+	p = chunk->data + chunk->used;
+	chunk->used += size;
+	arena->used += size;
+
+	return(p);
+}
+
+
+void *arena_alloc(struct arena *arena, size_t size) {
+	return(memset(arena_bump(arena, size), 0, size));
+}
+
+
+char *arena_strdup(struct arena *arena, const char *s) {
+	return(arena_strndup(arena, s, strlen(s)));
+}
+
+
+char *arena_strndup(struct arena *arena, const char *s, size_t n) {
+
+	char *p = arena_bump(arena, n + 1);
+
+	memcpy(p, s, n);
+	p[n] = '\0';
+
+	return(p);
+}
+
+
+size_t arena_used(struct arena *arena) {
+	return(arena->used);
+}
+
+
+void arena_free(struct arena *arena) {
+
+	struct arenachunk *chunk, *next;
+
+	if (arena == NULL)
+		return;
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	free(arena);
+}
@@ -0,0 +1,70 @@
+/*
+	arena.h
+*/
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+// default size of an arena chunk; larger allocations get a chunk of their own
+#define ARENACHUNK 65536
+
+// a chunk of arena memory, handed out front to back
+struct arenachunk {
+	struct arenachunk *next;
+	size_t size, used;
+	char data[];
+};
+
+// bump allocator; everything allocated from it is released at once
+struct arena {
+	struct arenachunk *chunks; // current chunk first
+	size_t used;               // bytes handed out
+	size_t allocated;          // bytes obtained from malloc
+};
+
+/*
+	arena_new: returns a new, empty arena
+*/
+
+struct arena *arena_new();
+
+
+/*
+	arena_alloc: returns size bytes of zeroed, pointer-aligned memory owned
+		by the arena
+*/
+
+void *arena_alloc(struct arena *arena, size_t size);
+
+
+/*
+	arena_strdup: returns a copy of s owned by the arena
+*/
+
+char *arena_strdup(struct arena *arena, const char *s);
+
+
+/*
+	arena_strndup: returns a NUL-terminated copy of the first n bytes of s
+		owned by the arena
+*/
+
+char *arena_strndup(struct arena *arena, const char *s, size_t n);
+
+
+/*
+	arena_used: returns the number of bytes handed out by the arena
+*/
+
+size_t arena_used(struct arena *arena);
+
+
+/*
+	arena_free: releases the arena and everything allocated from it
+*/
+
+void arena_free(struct arena *arena);
+
+#endif
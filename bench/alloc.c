@@ -0,0 +1,56 @@
+/*
+	alloc.c
+*/
+
+#include <stdlib.h>
+
+#include "bench.h"
+
+// glibc's allocator, which the wrappers below forward to
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static struct alloccount counts;
+
+
+// counts an allocation of size bytes; callable from any thread
+static void count_alloc(size_t size) {
+	__atomic_add_fetch(&counts.count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&counts.bytes, size, __ATOMIC_RELAXED);
+}
+
+
+/*
+	the benchmark replaces the allocator entry points, so allocations made
+	inside libc and libarchive are counted too
+*/
+
+void *malloc(size_t size) {
+	count_alloc(size);
+	return(__libc_malloc(size));
+}
+
+
+void *calloc(size_t nmemb, size_t size) {
+	count_alloc(nmemb * size);
+	return(__libc_calloc(nmemb, size));
+}
+
+
+void *realloc(void *ptr, size_t size) {
+	count_alloc(size);
+	return(__libc_realloc(ptr, size));
+}
+
+
+void free(void *ptr) {
+	__libc_free(ptr);
+}
+
+
+void alloc_counts(struct alloccount *ac) {
+	ac->count = __atomic_load_n(&counts.count, __ATOMIC_RELAXED);
+	ac->bytes = __atomic_load_n(&counts.bytes, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,525 @@
+/*
+	bench.c
+*/
+
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "bench.h"
+#include "outbuf.h"
+#include "pkgutil.h"
+
+// package name lookups per iteration of the package_in_packagedb runs
+#define LOOKUPS 1000
+
+// most benchmark results kept for the report
+#define MAXRESULTS 64
+
+// one measured benchmark; the counts are per iteration
+struct benchresult {
+	char name[64], params[128];
+	long iterations;
+	double seconds;
+	double items, bytes;        // work done, for the throughput
+	double allocs, allocbytes;
+	long peakrss;               // kB, while the benchmark ran
+};
+
+// what the benchmark functions work on
+struct benchctx {
+	char *path;                  // package database or package file
+	struct packagedb *packagedb;
+	char **names;                // names to look up, LOOKUPS of them
+	char *regex;
+	int jobs, sort;
+	long sink;                   // keeps lookups from being optimized away
+};
+
+static struct benchresult results[MAXRESULTS];
+static int numresults = 0;
+
+
+static double now() {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+
+// resets the peak resident set size of the process, where Linux allows it
+static void reset_peak_rss() {
+
+	FILE *fp;
+
+	if ((fp = fopen("/proc/self/clear_refs", "w")) != NULL) {
+		fputs("5", fp);
+		fclose(fp);
+	}
+}
+
+
+// returns the peak resident set size in kB since the last reset
+static long peak_rss() {
+
+	char line[256];
+	long kb = -1;
+	FILE *fp;
+	struct rusage ru;
+
+	if ((fp = fopen("/proc/self/status", "r")) != NULL) {
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+				break;
+		}
+		fclose(fp);
+	}
+	if (kb == -1 && getrusage(RUSAGE_SELF, &ru) == 0)
+		kb = ru.ru_maxrss;
+
+	return(kb);
+}
+
+
+static off_t file_size(char *path) {
+
+	struct stat st;
+
+	return(stat(path, &st) == 0 ? st.st_size : 0);
+}
+
+
+/*
+	run_bench: calls func once to warm up, then repeatedly for at least
+		mintime seconds, and records the time, allocations and peak memory
+		per call under name and params; items and bytes are the work done
+		by one call
+*/
+
+static void run_bench(char *name, char *params, void (*func)(struct benchctx *), struct benchctx *ctx, double items, double bytes, double mintime) {
+
+	struct alloccount before, after;
+	struct benchresult *r;
+	double start, elapsed;
+	long iterations = 0;
+
+	if (numresults == MAXRESULTS)
+		return;
+	r = &results[numresults++];
+
+	func(ctx);
+
+	reset_peak_rss();
+	alloc_counts(&before);
+	start = now();
+	do {
+		func(ctx);
+		iterations++;
+		elapsed = now() - start;
+	} while (elapsed < mintime);
+	alloc_counts(&after);
+
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	snprintf(r->params, sizeof(r->params), "%s", params);
+	r->iterations = iterations;
+	r->seconds = elapsed / iterations;
+	r->items = items;
+	r->bytes = bytes;
+	r->allocs = (double)(after.count - before.count) / iterations;
+	r->allocbytes = (double)(after.bytes - before.bytes) / iterations;
+	r->peakrss = peak_rss();
+
+	// the report may go to stdout, so the table goes to stderr
+	fprintf(stderr, "%-28s %-48s %10.3f ms %14.0f items/s %10.1f MB/s %12.0f allocs %8ld kB\n",
+		r->name, r->params, r->seconds * 1e3, r->items / r->seconds,
+		r->bytes / r->seconds / 1e6, r->allocs, r->peakrss);
+}
+
+
+static void bench_read_packagedb(struct benchctx *ctx) {
+	free_packagedb(read_packagedb(ctx->path));
+}
+
+
+static void bench_lookup_hash(struct benchctx *ctx) {
+
+	int c;
+
+	for (c = 0; c < LOOKUPS; c++) {
+		ctx->sink += package_in_packagedb(ctx->names[c], ctx->packagedb);
+	}
+}
+
+
+// package_in_packagedb as it was before the name index, for comparison
+static void bench_lookup_scan(struct benchctx *ctx) {
+
+	int c, p;
+
+	for (c = 0; c < LOOKUPS; c++) {
+		for (p = 0; p < ctx->packagedb->numpackages; p++) {
+			if (strcmp(ctx->names[c], ctx->packagedb->packages[p]->name) == 0)
+				break;
+		}
+		ctx->sink += p;
+	}
+}
+
+
+static void bench_index_owners(struct benchctx *ctx) {
+	drop_indexes(ctx->packagedb);
+	index_owners(ctx->packagedb);
+}
+
+
+static void bench_list_file_owners(struct benchctx *ctx) {
+
+	struct outbuf *out = outbuf_new(-1);
+
+	list_file_owners(ctx->packagedb, ctx->regex, ctx->jobs, out);
+	outbuf_free(out);
+}
+
+
+static void bench_create_package(struct benchctx *ctx) {
+	free_package(create_package_from_archive(ctx->path));
+}
+
+
+static void bench_make_footprint(struct benchctx *ctx) {
+
+	struct outbuf *out = outbuf_new(-1);
+
+	make_footprint(ctx->path, out, ctx->sort, 0);
+	outbuf_free(out);
+}
+
+
+// stores the extended regex matching exactly the path of a file in the
+// package database, as owners are matched with a leading '/', in buf
+static void exact_path_regex(const char *path, char *buf, size_t size) {
+
+	size_t len = snprintf(buf, size, "^/");
+
+	for (; *path && len + 3 < size; path++) {
+		if (strchr(".[]()*+?{}|^$\\", *path) != NULL)
+			buf[len++] = '\\';
+		buf[len++] = *path;
+	}
+	snprintf(buf + len, size - len, "$");
+}
+
+
+// returns the number of lines list_file_owners writes for regex
+static long count_owner_matches(struct benchctx *ctx) {
+
+	struct outbuf *out = outbuf_new(-1);
+	long c, matches = 0;
+
+	list_file_owners(ctx->packagedb, ctx->regex, ctx->jobs, out);
+	for (c = 0; c < out->len; c++) {
+		matches += (out->buf[c] == '\n');
+	}
+	outbuf_free(out);
+
+	return(matches);
+}
+
+
+// returns the number of files in the package database
+static long count_files(struct packagedb *packagedb) {
+
+	long c, numfiles = 0;
+
+	for (c = 0; c < packagedb->numpackages; c++) {
+		numfiles += packagedb->packages[c]->numfiles;
+	}
+
+	return(numfiles);
+}
+
+
+// writes params, "key=value ..." pairs, as the members of a JSON object
+static void write_params(FILE *fp, char *params) {
+
+	char buf[128], *pair, *value, *end, *save;
+	int first = 1;
+
+	snprintf(buf, sizeof(buf), "%s", params);
+	for (pair = strtok_r(buf, " ", &save); pair != NULL; pair = strtok_r(NULL, " ", &save)) {
+		if ((value = strchr(pair, '=')) == NULL)
+			continue;
+		*value++ = '\0';
+		strtol(value, &end, 10);
+		fprintf(fp, "%s\"%s\": ", first ? "" : ", ", pair);
+		fprintf(fp, (*value != '\0' && *end == '\0') ? "%s" : "\"%s\"", value);
+		first = 0;
+	}
+}
+
+
+// writes the report in JSON to path, or to stdout if path is "-"
+static int write_report(char *path, int packages, int files, int depth, int entries, int filesize, int jobs, double mintime) {
+
+	FILE *fp = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+	int c;
+
+	if (fp == NULL)
+		return(-1);
+
+	fprintf(fp, "{\n  \"version\": \"%s\",\n  \"time\": %ld,\n  \"cpus\": %d,\n", VERSION, (long)time(NULL), default_jobs());
+	fprintf(fp, "  \"parameters\": { \"packages\": %d, \"files\": %d, \"depth\": %d, \"entries\": %d, \"filesize\": %d, \"jobs\": %d, \"seconds\": %g },\n",
+		packages, files, depth, entries, filesize, jobs, mintime);
+	fprintf(fp, "  \"results\": [\n");
+	for (c = 0; c < numresults; c++) {
+		struct benchresult *r = &results[c];
+		fprintf(fp, "    { \"name\": \"%s\", \"params\": { ", r->name);
+		write_params(fp, r->params);
+		fprintf(fp, " }, \"iterations\": %ld, \"seconds\": %.9f, \"items_per_second\": %.1f, \"bytes_per_second\": %.1f, "
+			"\"allocations\": %.1f, \"allocated_bytes\": %.1f, \"peak_rss_kb\": %ld }%s\n",
+			r->iterations, r->seconds, r->items / r->seconds, r->bytes / r->seconds,
+			r->allocs, r->allocbytes, r->peakrss, c + 1 < numresults ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+
+	if (fp != stdout)
+		return(fclose(fp) == 0 ? 0 : -1);
+
+	return(0);
+}
+
+
+static void usage() {
+	printf("usage: cpkg-bench [options]\n"
+		"options:\n"
+		"  -p, --packages <n>          packages in the synthetic database (2000)\n"
+		"  -f, --files <n>             files per package (40)\n"
+		"  -d, --depth <n>             directory levels below a package's own (3)\n"
+		"  -e, --entries <n>           entries in the synthetic package files (20000)\n"
+		"  -s, --filesize <n>          bytes in each synthetic file (512)\n"
+		"  -j, --jobs <n>              threads for owner searches (0 for one per CPU)\n"
+		"  -t, --time <seconds>        least time spent on each benchmark (0.5)\n"
+		"  -q, --quick                 smaller sizes, for a quick check\n"
+		"  -w, --workdir <dir>         generate the inputs in <dir> and keep them\n"
+		"  -n, --names <n>             only check the package file name parser\n"
+		"                              against its regex on <n> generated names\n"
+		"  -o, --output <file>         write the JSON report to <file> (stdout)\n"
+		"                              while a table is printed to stderr\n"
+		"  -h, --help                  print help and exit\n");
+}
+
+
+int main(int argc, char *argv[]) {
+
+	int o_packages = 2000, o_files = 40, o_depth = 3, o_entries = 20000, o_filesize = 512, o_jobs = 0, o_quick = 0, o_names = 0;
+	double o_time = -1;
+	char *o_workdir = NULL, *o_output = "-";
+
+	// getopt(3) setup
+	int opt = 0, option_index = 1;
+
+	static struct option long_options[] = {
+		{ "packages", required_argument, NULL, 'p' },
+		{ "files",    required_argument, NULL, 'f' },
+		{ "depth",    required_argument, NULL, 'd' },
+		{ "entries",  required_argument, NULL, 'e' },
+		{ "filesize", required_argument, NULL, 's' },
+		{ "jobs",     required_argument, NULL, 'j' },
+		{ "time",     required_argument, NULL, 't' },
+		{ "quick",    no_argument,       NULL, 'q' },
+		{ "workdir",  required_argument, NULL, 'w' },
+		{ "names",    required_argument, NULL, 'n' },
+		{ "output",   required_argument, NULL, 'o' },
+		{ "help",     no_argument,       NULL, 'h' },
+		{ 0,          0,                 0,    0   }
+	};
+
+	while ((opt = getopt_long(argc, argv, "p:f:d:e:s:j:t:qw:n:o:h", long_options, &option_index)) != -1) {
+		switch (opt) {
+			case 'p': o_packages = atoi(optarg); break;
+			case 'f': o_files = atoi(optarg); break;
+			case 'd': o_depth = atoi(optarg); break;
+			case 'e': o_entries = atoi(optarg); break;
+			case 's': o_filesize = atoi(optarg); break;
+			case 'j': o_jobs = atoi(optarg); break;
+			case 't': o_time = atof(optarg); break;
+			case 'q': o_quick = 1; break;
+			case 'w': o_workdir = optarg; break;
+			case 'n': o_names = atoi(optarg); break;
+			case 'o': o_output = optarg; break;
+			case 'h': usage(); exit(0);
+			default: usage(); exit(1);
+		}
+	}
+
+	// a correctness check rather than a benchmark; fails on any difference
+	if (o_names > 0) {
+		int differ = check_package_names(o_names, 12345);
+		printf("cpkg-bench: %d names checked, %d differ\n", o_names, differ);
+		exit(differ == 0 ? 0 : 1);
+	}
+
+	if (o_quick) {
+		o_packages = 500;
+		o_entries = 5000;
+		o_time = o_time < 0 ? 0.1 : o_time;
+	}
+	o_time = o_time < 0 ? 0.5 : o_time;
+	if (o_packages < 1 || o_files < 1 || o_depth < 0 || o_entries < 1 || o_filesize < 0) {
+		fprintf(stderr, "cpkg-bench: sizes must be positive\n");
+		exit(1);
+	}
+
+	// the inputs go in a temporary directory unless one was given
+	char workdir[256], path[PATH_MAX], params[128];
+	if (o_workdir != NULL) {
+		if (strlen(o_workdir) >= sizeof(workdir)) {
+			fprintf(stderr, "cpkg-bench: work directory name too long\n");
+			exit(1);
+		}
+		snprintf(workdir, sizeof(workdir), "%s", o_workdir);
+	} else {
+		snprintf(workdir, sizeof(workdir), "/tmp/cpkg-bench.XXXXXX");
+		if (mkdtemp(workdir) == NULL) {
+			fprintf(stderr, "cpkg-bench: could not create a work directory\n");
+			exit(1);
+		}
+	}
+
+	struct benchctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.jobs = o_jobs;
+
+	int scales[] = { 1000, 10000, 100000 };
+	int numscales = o_quick ? 2 : 3;
+	char *formats[] = { "gz", "xz", "zst" };
+	int c, s, linkentries = o_quick ? 20000 : 100000;
+	char *generated[16];
+	int numgenerated = 0;
+	unsigned int seed = 12345;
+
+	fprintf(stderr, "cpkg-bench: generating inputs in '%s'\n", workdir);
+
+	// the package database and its file operations
+	snprintf(path, sizeof(path), "%s/db", workdir);
+	if (gen_packagedb(path, o_packages, o_files, o_depth, seed) == -1) {
+		fprintf(stderr, "cpkg-bench: could not write '%s'\n", path);
+		exit(1);
+	}
+	generated[numgenerated++] = strdup(path);
+
+	ctx.path = path;
+	ctx.packagedb = read_packagedb(path);
+	long numfiles = count_files(ctx.packagedb);
+	snprintf(params, sizeof(params), "packages=%d files=%ld", o_packages, numfiles);
+	run_bench("read_packagedb", params, bench_read_packagedb, &ctx, numfiles, file_size(path), o_time);
+
+	run_bench("index_owners", params, bench_index_owners, &ctx, numfiles, 0, o_time);
+
+	// a whole path, a package's directory, and a pattern matching
+	// anywhere in the path
+	struct package *mid = ctx.packagedb->packages[ctx.packagedb->numpackages / 2];
+	char literal[2 * PATH_MAX], anchored[PATH_MAX];
+	exact_path_regex(mid->files[mid->numfiles - 1], literal, sizeof(literal));
+	snprintf(anchored, sizeof(anchored), "^/usr/share/%s/", mid->name);
+	char *patterns[][2] = {
+		{ "literal", literal },
+		{ "anchored", anchored },
+		{ "unanchored", "d[0-3]/f1[0-9]\\.(h|so)$" },
+	};
+	for (c = 0; c < 3; c++) {
+		ctx.regex = patterns[c][1];
+		// a pattern matching nothing would only time the way out
+		if (count_owner_matches(&ctx) == 0) {
+			fprintf(stderr, "cpkg-bench: owner pattern '%s' matches nothing\n", ctx.regex);
+			exit(1);
+		}
+		snprintf(params, sizeof(params), "packages=%d files=%ld pattern=%s", o_packages, numfiles, patterns[c][0]);
+		run_bench("list_file_owners", params, bench_list_file_owners, &ctx, numfiles, 0, o_time);
+	}
+	free_packagedb(ctx.packagedb);
+
+	// name lookups: the hash index against the scan it replaced
+	ctx.names = calloc(LOOKUPS, sizeof(char *));
+	for (s = 0; s < numscales; s++) {
+		snprintf(path, sizeof(path), "%s/db-%d", workdir, scales[s]);
+		if (gen_packagedb(path, scales[s], 4, 1, seed + s) == -1) {
+			fprintf(stderr, "cpkg-bench: could not write '%s'\n", path);
+			exit(1);
+		}
+		generated[numgenerated++] = strdup(path);
+		ctx.packagedb = read_packagedb(path);
+
+		// one lookup in ten is for a package that isn't installed
+		for (c = 0; c < LOOKUPS; c++) {
+			if (c % 10 == 9)
+				ctx.names[c] = "not-installed";
+			else
+				ctx.names[c] = ctx.packagedb->packages[(c * 7919L) % ctx.packagedb->numpackages]->name;
+		}
+
+		snprintf(params, sizeof(params), "packages=%d method=hash", scales[s]);
+		run_bench("package_in_packagedb", params, bench_lookup_hash, &ctx, LOOKUPS, 0, o_time);
+		snprintf(params, sizeof(params), "packages=%d method=scan", scales[s]);
+		run_bench("package_in_packagedb", params, bench_lookup_scan, &ctx, LOOKUPS, 0, o_time);
+
+		free_packagedb(ctx.packagedb);
+		ctx.packagedb = NULL;
+	}
+	free(ctx.names);
+
+	// package files in each compression
+	for (c = 0; c < 3; c++) {
+		snprintf(path, sizeof(path), "%s/bench#1.0-1.pkg.tar.%s", workdir, formats[c]);
+		if (gen_package_archive(path, o_entries, 5, o_depth, o_filesize, seed) == -1) {
+			fprintf(stderr, "cpkg-bench: could not write '%s'\n", path);
+			exit(1);
+		}
+		generated[numgenerated++] = strdup(path);
+
+		ctx.path = path;
+		snprintf(params, sizeof(params), "format=%s entries=%d", formats[c], o_entries);
+		run_bench("create_package_from_archive", params, bench_create_package, &ctx, o_entries, file_size(path), o_time);
+		for (ctx.sort = 0; ctx.sort <= 1; ctx.sort++) {
+			snprintf(params, sizeof(params), "format=%s entries=%d sort=%d", formats[c], o_entries, ctx.sort);
+			run_bench("make_footprint", params, bench_make_footprint, &ctx, o_entries, file_size(path), o_time);
+		}
+	}
+
+	// footprint of a large package where a fifth of the entries are hardlinks
+	snprintf(path, sizeof(path), "%s/links#1.0-1.pkg.tar.gz", workdir);
+	if (gen_package_archive(path, linkentries, 20, o_depth, 0, seed) == -1) {
+		fprintf(stderr, "cpkg-bench: could not write '%s'\n", path);
+		exit(1);
+	}
+	generated[numgenerated++] = strdup(path);
+	ctx.path = path;
+	ctx.sort = 0;
+	snprintf(params, sizeof(params), "format=gz entries=%d hardlinks=20", linkentries);
+	run_bench("make_footprint", params, bench_make_footprint, &ctx, linkentries, file_size(path), o_time);
+
+	if (write_report(o_output, o_packages, o_files, o_depth, o_entries, o_filesize, o_jobs, o_time) == -1) {
+		fprintf(stderr, "cpkg-bench: could not write '%s'\n", o_output);
+		exit(1);
+	}
+
+	// clean up the generated inputs, unless asked to keep them
+	for (c = 0; c < numgenerated; c++) {
+		if (o_workdir == NULL)
+			unlink(generated[c]);
+		free(generated[c]);
+	}
+	if (o_workdir == NULL)
+		rmdir(workdir);
+
+	return(0);
+}
@@ -0,0 +1,52 @@
+/*
+	bench.h
+*/
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stddef.h>
+
+// allocations made through malloc, calloc and realloc since the start
+struct alloccount {
+	long count;
+	size_t bytes;
+};
+
+/*
+	alloc_counts: stores the current allocation counters in ac
+*/
+
+void alloc_counts(struct alloccount *ac);
+
+
+/*
+	gen_packagedb: writes a synthetic package database to path with
+		numpackages packages owning about numfiles paths each, nested up to
+		depth directories below the package's own, plus shared files in
+		usr/bin and usr/lib; returns 0 on success or -1
+*/
+
+int gen_packagedb(char *path, int numpackages, int numfiles, int depth, unsigned int seed);
+
+
+/*
+	gen_package_archive: writes a synthetic package file to path with
+		numentries files and links, nested up to depth directories, of which
+		hardlinks percent are hardlinks to earlier files; regular files
+		hold filesize bytes of text; the compression follows the extension
+		of path (.gz, .xz or .zst); returns 0 on success or -1
+*/
+
+int gen_package_archive(char *path, int numentries, int hardlinks, int depth, size_t filesize, unsigned int seed);
+
+
+/*
+	check_package_names: runs parse_package_filename and PKGREGEX over a
+		fixed list of edge cases and count generated names, printing every
+		name they disagree on; returns the number of such names, or -1
+*/
+
+int check_package_names(int count, unsigned int seed);
+
+#endif
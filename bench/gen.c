@@ -0,0 +1,230 @@
+/*
+	gen.c
+*/
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "bench.h"
+#include "hashmap.h"
+
+// package name prefixes, in sorted order so the generated names are too
+static const char *prefixes[] = { "gtk", "lib", "perl-", "py3-", "xorg-" };
+
+// extensions given to the generated files
+static const char *extensions[] = { "h", "so", "py", "pm", "html", "png", "txt", "conf" };
+
+#define NUMPREFIXES (sizeof(prefixes) / sizeof(prefixes[0]))
+#define NUMEXTENSIONS (sizeof(extensions) / sizeof(extensions[0]))
+
+
+// xorshift32; deterministic for a given seed
+static unsigned int next_random(unsigned int *state) {
+
+	unsigned int x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return(*state = x);
+}
+
+
+static int path_cmp(const void *a, const void *b) {
+	return(strcmp(*(char **)a, *(char **)b));
+}
+
+
+/*
+	subdir_path: stores the directories a generated file numbered k sits
+		in below base in path, up to levels deep, each ending with '/'
+*/
+
+static void subdir_path(char *path, size_t size, const char *base, int k, int levels) {
+
+	int l, len = snprintf(path, size, "%s", base);
+
+	for (l = 0; l < levels && len < size; l++) {
+		len += snprintf(path + len, size - len, "d%d/", (k >> (2 * l)) & 3);
+	}
+}
+
+
+int gen_packagedb(char *path, int numpackages, int numfiles, int depth, unsigned int seed) {
+
+	char name[64], dir[256], file[PATH_MAX], *s;
+	int c, f, numpaths, arrsize;
+	FILE *fp;
+
+	if ((fp = fopen(path, "w")) == NULL)
+		return(-1);
+
+	arrsize = 2 * numfiles + 16;
+	char **paths = malloc(arrsize * sizeof(char *));
+	seed = seed ? seed : 1;
+
+	for (c = 0; c < numpackages; c++) {
+		snprintf(name, sizeof(name), "%s%06d", prefixes[c * NUMPREFIXES / numpackages], c);
+		fprintf(fp, "%s\n%u.%u.%u-%u\n", name, next_random(&seed) % 10, next_random(&seed) % 20, next_random(&seed) % 10, 1 + next_random(&seed) % 3);
+
+		// every package lists the shared directories it installs into
+		numpaths = 0;
+		paths[numpaths++] = strdup("usr/");
+		paths[numpaths++] = strdup("usr/share/");
+		snprintf(dir, sizeof(dir), "usr/share/%s/", name);
+		paths[numpaths++] = strdup(dir);
+
+		for (f = 0; f < numfiles; f++) {
+			if (numpaths + depth + 2 >= arrsize) {
+				arrsize *= 2;
+				paths = realloc(paths, arrsize * sizeof(char *));
+			}
+			switch (next_random(&seed) % 8) {
+				case 0:
+					paths[numpaths++] = strdup("usr/bin/");
+					snprintf(file, sizeof(file), "usr/bin/%s-%d", name, f);
+					break;
+				case 1:
+					paths[numpaths++] = strdup("usr/lib/");
+					snprintf(file, sizeof(file), "usr/lib/lib%s.so.%d", name, f);
+					break;
+				default:
+					snprintf(file, sizeof(file), "usr/share/%s/", name);
+					subdir_path(dir, sizeof(dir), file, f, next_random(&seed) % (depth + 1));
+					snprintf(file, sizeof(file), "%sf%d.%s", dir, f, extensions[next_random(&seed) % NUMEXTENSIONS]);
+
+					// and the directories leading there
+					for (s = dir + strlen("usr/share/") + strlen(name) + 1; *s != '\0'; s++) {
+						if (*s == '/')
+							paths[numpaths++] = strndup(dir, s + 1 - dir);
+					}
+					break;
+			}
+			paths[numpaths++] = strdup(file);
+		}
+
+		// sorted and without duplicates, as pkgutils writes it
+		qsort(paths, numpaths, sizeof(char *), path_cmp);
+		for (f = 0; f < numpaths; f++) {
+			if (f == 0 || strcmp(paths[f], paths[f - 1]) != 0)
+				fprintf(fp, "%s\n", paths[f]);
+		}
+		fputc('\n', fp);
+
+		for (f = 0; f < numpaths; f++) {
+			free(paths[f]);
+		}
+	}
+
+	free(paths);
+
+	return(fclose(fp) == 0 ? 0 : -1);
+}
+
+
+// adds an entry for path with the given type and permissions to a;
+// returns 0 or -1
+static int write_header(struct archive *a, const char *path, mode_t type, mode_t perm, size_t size, const char *link) {
+
+	struct archive_entry *entry = archive_entry_new();
+	int r;
+
+	archive_entry_set_pathname(entry, path);
+	archive_entry_set_filetype(entry, type);
+	archive_entry_set_perm(entry, perm);
+	archive_entry_set_size(entry, size);
+	archive_entry_set_uid(entry, 0);
+	archive_entry_set_gid(entry, 0);
+	archive_entry_set_mtime(entry, 1700000000, 0);
+	if (link != NULL)
+		archive_entry_set_hardlink(entry, link);
+
+	r = archive_write_header(a, entry);
+	archive_entry_free(entry);
+
+	return(r < ARCHIVE_WARN ? -1 : 0);
+}
+
+
+int gen_package_archive(char *path, int numentries, int hardlinks, int depth, size_t filesize, unsigned int seed) {
+
+	char dir[256], file[PATH_MAX], *s, *ext;
+	int c, numfiles = 0, failed = 0;
+	size_t i;
+
+	struct archive *a = archive_write_new();
+	archive_write_set_format_pax_restricted(a);
+
+	if ((ext = strrchr(path, '.')) != NULL && strcmp(ext, ".xz") == 0)
+		archive_write_add_filter_xz(a);
+	else if (ext != NULL && strcmp(ext, ".zst") == 0)
+		archive_write_add_filter_zstd(a);
+	else
+		archive_write_add_filter_gzip(a);
+
+	if (archive_write_open_filename(a, path) != ARCHIVE_OK) {
+		archive_write_free(a);
+		return(-1);
+	}
+
+	// text with some repetition, so it compresses like real files do
+	char *data = malloc(filesize + 1);
+	seed = seed ? seed : 1;
+	for (i = 0; i < filesize; i++) {
+		data[i] = (i % 64 == 63) ? '\n' : "etaoin shrdlu"[next_random(&seed) % 13];
+	}
+
+	// directories are added once, before the first file in them
+	struct hashmap *dirs = hashmap_new(0);
+	char **files = malloc((numentries + 1) * sizeof(char *));
+
+	failed |= write_header(a, "usr/", AE_IFDIR, 0755, 0, NULL);
+	failed |= write_header(a, "usr/share/", AE_IFDIR, 0755, 0, NULL);
+
+	for (c = 0; c < numentries && !failed; c++) {
+		subdir_path(dir, sizeof(dir), "usr/share/bench/", c, next_random(&seed) % (depth + 1));
+		for (s = dir + strlen("usr/share/"); *s != '\0'; s++) {
+			if (*s != '/')
+				continue;
+			snprintf(file, sizeof(file), "%.*s", (int)(s + 1 - dir), dir);
+			if (hashmap_get(dirs, file) == NULL) {
+				char *d = strdup(file);
+				*hashmap_insert(dirs, d) = d;
+				failed |= write_header(a, d, AE_IFDIR, 0755, 0, NULL);
+			}
+		}
+		snprintf(file, sizeof(file), "%sf%d.%s", dir, c, extensions[c % NUMEXTENSIONS]);
+
+		if (numfiles > 0 && next_random(&seed) % 100 < hardlinks) {
+			failed |= write_header(a, file, AE_IFREG, 0644, 0, files[next_random(&seed) % numfiles]);
+		} else {
+			failed |= write_header(a, file, AE_IFREG, (c % 10 == 0) ? 0755 : 0644, filesize, NULL);
+			if (filesize > 0 && archive_write_data(a, data, filesize) != (la_ssize_t)filesize)
+				failed = -1;
+			files[numfiles++] = strdup(file);
+		}
+	}
+
+	if (archive_write_close(a) != ARCHIVE_OK)
+		failed = -1;
+	archive_write_free(a);
+
+	for (i = 0; i < dirs->size; i++) {
+		free(dirs->entries[i].value);
+	}
+	for (c = 0; c < numfiles; c++) {
+		free(files[c]);
+	}
+	hashmap_free(dirs);
+	free(files);
+	free(data);
+
+	return(failed ? -1 : 0);
+}
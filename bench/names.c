@@ -0,0 +1,170 @@
+/*
+	names.c
+*/
+
+#include <ctype.h>
+#include <limits.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "pkgutil.h"
+
+// names every run checks, besides the generated ones
+static const char *edgecases[] = {
+	"foo#1.0-1.pkg.tar.gz", "foo#1.0-1.pkg.tar.xz", "foo#1.0-1.pkg.tar.bz2", "foo#1.0-1.pkg.tar.zst",
+	"foo#1.0-1.pkg.tar.lz", "foo#1.0-1.pkg.tar", "foo#1.0-1.tar.gz", "foo#1.0-1.pkg.tar.gz.sig",
+	"foo#1.0-1pkg.tar.gz", "foo#1.0-.pkg.tar.gz", "foo#1.0.pkg.tar.gz", "foo#-1.pkg.tar.gz",
+	"foo#--1.pkg.tar.gz", "foo#1-2-3.pkg.tar.gz", "foo#1-23.pkg.tar.gz", "foo#a#b-1.pkg.tar.gz",
+	"foo##1-1.pkg.tar.gz", "#1.0-1.pkg.tar.gz", "-foo#1.0-1.pkg.tar.gz", "_foo#1.0-1.pkg.tar.gz",
+	"foo-#1.0-1.pkg.tar.gz", "foo.bar#1.0-1.pkg.tar.gz", "foo bar#1.0-1.pkg.tar.gz", "foo#1 0-1.pkg.tar.gz",
+	"foo#1.0-2147483647.pkg.tar.gz", "foo#1.0-2147483648.pkg.tar.gz", "foo#1.0-0000000000001.pkg.tar.gz",
+	"foo#1.0-99999999999999999999999.pkg.tar.gz", "foo#1.0-1.pkg.tar.gz.pkg.tar.xz",
+	"dir/foo#1.0-1.pkg.tar.gz", "a#b/foo#1.0-1.pkg.tar.gz", "/foo#1.0-1.pkg.tar.gz", "foo#1.0-1.pkg.tar.",
+	"foo#.pkg.tar.gz", "foo", "", "foo#1.0-1.PKG.TAR.GZ", "foo#1.0\t-1.pkg.tar.gz",
+};
+
+// pieces the generated names are made of
+static const char *namechars = "abcxyzABZ0189_-.+ #";
+static const char *versionchars = "0123456789.-_abz+~:# /";
+static const char *suffixes[] = {
+	".pkg.tar.gz", ".pkg.tar.xz", ".pkg.tar.bz2", ".pkg.tar.zst", ".pkg.tar.lz", ".pkg.tar",
+	".tar.gz", "pkg.tar.gz", ".pkg.tar.gz.sig", ".pkg.tar.xz.pkg.tar.gz", ".pkg-tar.gz", "",
+};
+
+
+// xorshift32, as in gen.c
+static unsigned int next_random(unsigned int *state) {
+
+	unsigned int x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return(*state = x);
+}
+
+
+/*
+	regex_parse: parses filename with PKGREGEX, as create_package_from_archive
+		did, plus the checks parse_package_filename documents as stricter:
+		the match must end the name, the release must fit an int and the
+		version must be printable; returns 0 and fills pn, or -1
+*/
+
+static int regex_parse(regex_t *cregex, char *filename, struct pkgname *pn) {
+
+	regmatch_t pmatch[5];
+	char *bname = strrchr(filename, '/');
+	long long release;
+	int c;
+
+	bname = bname ? bname + 1 : filename;
+	memset(pn, 0, sizeof(struct pkgname));
+
+	if (regexec(cregex, bname, 5, pmatch, 0) != 0 || bname[pmatch[0].rm_eo] != '\0')
+		return(-1);
+
+	release = strtoll(bname + pmatch[3].rm_so, NULL, 10);
+	if (release > INT_MAX)
+		return(-1);
+	for (c = pmatch[2].rm_so; c < pmatch[2].rm_eo; c++) {
+		if (!isgraph((unsigned char)bname[c]))
+			return(-1);
+	}
+
+	pn->name = bname + pmatch[1].rm_so;
+	pn->namelen = pmatch[1].rm_eo - pmatch[1].rm_so;
+	pn->version = bname + pmatch[2].rm_so;
+	pn->versionlen = pmatch[2].rm_eo - pmatch[2].rm_so;
+	pn->ext = bname + pmatch[4].rm_so;
+	pn->release = release;
+
+	return(0);
+}
+
+
+// compares both parsers on filename; returns 0 if they agree
+static int check_name(regex_t *cregex, char *filename) {
+
+	struct pkgname want, got;
+	char *error;
+	int r1 = regex_parse(cregex, filename, &want);
+	int r2 = parse_package_filename(filename, &got, &error);
+
+	if (r1 != r2) {
+		printf("names: '%s': regex %s, parser %s\n", filename,
+			r1 == 0 ? "accepts" : "rejects", r2 == 0 ? "accepts" : "rejects");
+		return(-1);
+	}
+	if (r1 == 0 && (want.name != got.name || want.namelen != got.namelen
+			|| want.version != got.version || want.versionlen != got.versionlen
+			|| want.ext != got.ext || want.release != got.release)) {
+		printf("names: '%s': regex '%.*s' '%.*s' %d, parser '%.*s' '%.*s' %d\n", filename,
+			(int)want.namelen, want.name, (int)want.versionlen, want.version, want.release,
+			(int)got.namelen, got.name, (int)got.versionlen, got.version, got.release);
+		return(-1);
+	}
+
+	return(0);
+}
+
+
+int check_package_names(int count, unsigned int seed) {
+
+	char name[256];
+	regex_t cregex;
+	int c, i, len, differ = 0;
+
+	if (regcomp(&cregex, PKGREGEX, REG_EXTENDED) != 0) {
+		printf("names: could not compile '%s'\n", PKGREGEX);
+		return(-1);
+	}
+
+	for (c = 0; c < sizeof(edgecases) / sizeof(edgecases[0]); c++) {
+		snprintf(name, sizeof(name), "%s", edgecases[c]);
+		differ += (check_name(&cregex, name) != 0);
+	}
+
+	seed = seed ? seed : 1;
+	for (c = 0; c < count; c++) {
+		len = 0;
+
+		// mostly well-formed names, with a stray character now and then
+		if (next_random(&seed) % 8 == 0)
+			len += snprintf(name + len, sizeof(name) - len, "%s/", next_random(&seed) % 2 ? "dir" : "a#1-1");
+		for (i = next_random(&seed) % 10; i >= 0; i--) {
+			name[len++] = (next_random(&seed) % 6 == 0)
+				? namechars[next_random(&seed) % strlen(namechars)]
+				: "abcdefghij"[next_random(&seed) % 10];
+		}
+		if (next_random(&seed) % 16 != 0)
+			name[len++] = '#';
+		for (i = next_random(&seed) % 10; i > 0; i--) {
+			name[len++] = (next_random(&seed) % 4 == 0)
+				? versionchars[next_random(&seed) % strlen(versionchars)]
+				: "0123456789."[next_random(&seed) % 11];
+		}
+		if (next_random(&seed) % 16 != 0)
+			name[len++] = '-';
+		switch (next_random(&seed) % 16) {
+			case 0: break;
+			case 1: len += snprintf(name + len, sizeof(name) - len, "%u%u", next_random(&seed), next_random(&seed)); break;
+			case 2: len += snprintf(name + len, sizeof(name) - len, "%u", 2147483640 + next_random(&seed) % 16); break;
+			default: len += snprintf(name + len, sizeof(name) - len, "%u", next_random(&seed) % 20); break;
+		}
+		name[len] = '\0';
+		i = next_random(&seed) % 32;
+		snprintf(name + len, sizeof(name) - len, "%s",
+			suffixes[i < 24 ? i % 4 : 4 + (i - 24) % (sizeof(suffixes) / sizeof(suffixes[0]) - 4)]);
+
+		differ += (check_name(&cregex, name) != 0);
+	}
+
+	regfree(&cregex);
+
+	return(differ);
+}
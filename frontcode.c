@@ -0,0 +1,142 @@
+/*
+	frontcode.c
+*/
+
+#include <string.h>
+
+#include "arena.h"
+#include "frontcode.h"
+
+// length of the prefix a and b have in common
+static size_t shared_prefix(const char *a, const char *b) {
+
+	size_t n = 0;
+
+	while (a[n] && a[n] == b[n]) {
+		n++;
+	}
+
+	return(n);
+}
+
+
+int fclist_sorted(char **files, int numfiles) {
+
+	int c;
+
+	for (c = 0; c < numfiles; c++) {
+		if (strlen(files[c]) >= PATH_MAX)
+			return(0);
+		if (c > 0 && strcmp(files[c - 1], files[c]) > 0)
+			return(0);
+	}
+
+	return(1);
+}
+
+
+struct fclist *fclist_new(struct arena *arena, char **files, int numfiles) {
+
+	struct fclist *list = arena_alloc(arena, sizeof(struct fclist));
+	size_t shared, len, size = 0;
+	int c;
+
+	// size the data first so it is a single allocation
+	for (c = 0; c < numfiles; c++) {
+		shared = (c % FCBLOCK) ? shared_prefix(files[c - 1], files[c]) : 0;
+		size += (shared < 128 ? 1 : 2) + strlen(files[c]) - shared + 1;
+	}
+
+	list->numfiles = numfiles;
+	list->blocks = arena_alloc(arena, ((numfiles + FCBLOCK - 1) / FCBLOCK) * sizeof(uint32_t));
+	list->data = arena_alloc(arena, size ? size : 1);
+	list->size = size;
+
+	for (c = 0, size = 0; c < numfiles; c++) {
+		if (c % FCBLOCK == 0) {
+			list->blocks[c / FCBLOCK] = size;
+			shared = 0;
+		} else {
+			shared = shared_prefix(files[c - 1], files[c]);
+		}
+
+		// prefix length, low seven bits first
+		if (shared < 128) {
+			list->data[size++] = shared;
+		} else {
+			list->data[size++] = (shared & 0x7f) | 0x80;
+			list->data[size++] = shared >> 7;
+		}
+
+		len = strlen(files[c] + shared) + 1;
+		memcpy(list->data + size, files[c] + shared, len);
+		size += len;
+	}
+
+	return(list);
+}
+
+
+void fciter_init(struct fciter *it, struct fclist *list) {
+
+	it->list = list;
+	it->index = -1;
+	it->offset = 0;
+	it->path[0] = '\0';
+}
+
+
+const char *fciter_next(struct fciter *it) {
+
+	struct fclist *list = it->list;
+	unsigned char *p;
+	size_t shared, len;
+
+	if (it->index + 1 >= list->numfiles)
+		return(NULL);
+
+	p = (unsigned char *)list->data + it->offset;
+	shared = *p & 0x7f;
+	if (*p++ & 0x80)
+		shared |= (size_t)*p++ << 7;
+
+	len = strlen((char *)p) + 1;
+	memcpy(it->path + shared, p, len);
+
+	it->offset = (char *)p + len - list->data;
+	it->index++;
+
+	return(it->path);
+}
+
+
+const char *fciter_seek(struct fciter *it, struct fclist *list, const char *key) {
+
+	int lo = 0, hi, mid, numblocks;
+	const char *path;
+
+	fciter_init(it, list);
+
+	// find the last block whose head is below key; heads are stored whole,
+	// after a zero prefix length byte
+	numblocks = (list->numfiles + FCBLOCK - 1) / FCBLOCK;
+	hi = numblocks;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(list->data + list->blocks[mid] + 1, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo > 0) {
+		it->index = (lo - 1) * FCBLOCK - 1;
+		it->offset = list->blocks[lo - 1];
+	}
+
+	// then decode forward to the first path not below it
+	while ((path = fciter_next(it)) != NULL && strcmp(path, key) < 0)
+		;
+
+	return(path);
+}
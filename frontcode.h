@@ -0,0 +1,77 @@
+/*
+	frontcode.h
+*/
+
+#ifndef _FRONTCODE_H_
+#define _FRONTCODE_H_
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// number of paths in a front-coding block; the first one is stored whole
+#define FCBLOCK 16
+
+/*
+	front-coded file list: sorted paths in blocks of FCBLOCK, each path
+	stored as the length of the prefix it shares with the one before it
+	(a one or two byte varint, 0 for the first path of a block) followed
+	by the rest of the path and a NUL
+*/
+struct fclist {
+	int numfiles;
+	uint32_t *blocks; // offset of every block in data
+	char *data;
+	size_t size;      // bytes in data
+};
+
+// position in a front-coded file list, with the current path decoded
+struct fciter {
+	struct fclist *list;
+	int index;        // index of path; -1 before the first
+	size_t offset;    // offset of the next path in data
+	char path[PATH_MAX];
+};
+
+/*
+	fclist_sorted: returns 1 if the numfiles paths in files are sorted and
+		short enough to be front-coded, 0 otherwise
+*/
+
+int fclist_sorted(char **files, int numfiles);
+
+
+/*
+	fclist_new: returns a front-coded copy of the sorted file list files,
+		allocated in arena
+*/
+
+struct fclist *fclist_new(struct arena *arena, char **files, int numfiles);
+
+
+/*
+	fciter_init: positions it before the first path of list
+*/
+
+void fciter_init(struct fciter *it, struct fclist *list);
+
+
+/*
+	fciter_next: decodes the next path into it->path and returns it, or
+		returns NULL at the end of the list
+*/
+
+const char *fciter_next(struct fciter *it);
+
+
+/*
+	fciter_seek: positions it on the first path of list not below key,
+		found by binary search over the block heads, and returns it; returns
+		NULL if every path is below key
+*/
+
+const char *fciter_seek(struct fciter *it, struct fclist *list, const char *key);
+
+#endif
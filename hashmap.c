@@ -0,0 +1,97 @@
+/*
+	hashmap.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashmap.h"
+#include "pkgutil.h"
+
+
+static struct hashentry *hashmap_alloc(size_t size) {
+
+	struct hashentry *entries = calloc(size, sizeof(struct hashentry));
+
+	if (entries == NULL) {
+		printf("Failed to allocate memory!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return(entries);
+}
+
+
+struct hashmap *hashmap_new(size_t hint) {
+
+	struct hashmap *map = calloc(1, sizeof(struct hashmap));
+
+	// keep the map at most half full
+	map->size = 16;
+	while (map->size < 2 * hint) {
+		map->size *= 2;
+	}
+	map->entries = hashmap_alloc(map->size);
+
+	return(map);
+}
+
+
+// returns the slot holding key, or the empty slot where it would go
+static struct hashentry *hashmap_find(struct hashentry *entries, size_t size, const char *key, unsigned int hash) {
+
+	size_t mask = size - 1, h;
+
+	for (h = hash & mask; entries[h].key != NULL; h = (h + 1) & mask) {
+		if (entries[h].hash == hash && strcmp(entries[h].key, key) == 0)
+			break;
+	}
+
+	return(&entries[h]);
+}
+
+
+void *hashmap_get(struct hashmap *map, const char *key) {
+
+	struct hashentry *e = hashmap_find(map->entries, map->size, key, strhash(key));
+
+	return(e->key != NULL ? e->value : NULL);
+}
+
+
+void **hashmap_insert(struct hashmap *map, const char *key) {
+
+	size_t c;
+	unsigned int hash = strhash(key);
+	struct hashentry *e;
+
+	if (2 * (map->count + 1) > map->size) {
+		// double the map and move the keys over
+		struct hashentry *entries = hashmap_alloc(map->size * 2);
+		for (c = 0; c < map->size; c++) {
+			if (map->entries[c].key != NULL)
+				*hashmap_find(entries, map->size * 2, map->entries[c].key, map->entries[c].hash) = map->entries[c];
+		}
+		free(map->entries);
+		map->entries = entries;
+		map->size *= 2;
+	}
+
+	e = hashmap_find(map->entries, map->size, key, hash);
+	if (e->key == NULL) {
+		e->key = key;
+		e->hash = hash;
+		e->value = NULL;
+		map->count++;
+	}
+
+	return(&e->value);
+}
+
+
+void hashmap_free(struct hashmap *map) {
+
+	free(map->entries);
+	free(map);
+}
@@ -0,0 +1,53 @@
+/*
+	hashmap.h
+*/
+
+#ifndef _HASHMAP_H_
+#define _HASHMAP_H_
+
+#include <stddef.h>
+
+// slot of a hash map; an empty slot has a NULL key
+struct hashentry {
+	const char *key;
+	unsigned int hash;
+	void *value;
+};
+
+// open-addressing hash map from strings to pointers; keys are not copied
+// and must outlive the map
+struct hashmap {
+	struct hashentry *entries;
+	size_t size;  // number of slots, a power of two
+	size_t count; // number of keys
+};
+
+/*
+	hashmap_new: returns an empty hash map sized for about hint keys
+*/
+
+struct hashmap *hashmap_new(size_t hint);
+
+
+/*
+	hashmap_get: returns the value stored for key, or NULL
+*/
+
+void *hashmap_get(struct hashmap *map, const char *key);
+
+
+/*
+	hashmap_insert: returns a pointer to the value slot for key, adding
+		key with a NULL value if it is not in the map yet
+*/
+
+void **hashmap_insert(struct hashmap *map, const char *key);
+
+
+/*
+	hashmap_free: frees the hash map, but not the keys or values
+*/
+
+void hashmap_free(struct hashmap *map);
+
+#endif
@@ -8,7 +8,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "pkgadd.h"
+#include "pkgdaemon.h"
+#include "pkgfold.h"
 #include "pkginfo.h"
+#include "pkgrm.h"
 #include "pkgutil.h"
 
 int main(int argc, char *argv[]) {
@@ -51,9 +55,22 @@ int main(int argc, char *argv[]) {
 	int (*runfunc)();
 	runfunc = NULL;
 
-	// only 'pkginfo' implemented so far
 	if (strcmp(utilname, "pkginfo") == 0) {
 		runfunc = helpwanted ? pkginfo_help : pkginfo_run;
+	} else if (strcmp(utilname, "pkgadd") == 0) {
+		runfunc = helpwanted ? pkgadd_help : pkgadd_run;
+	} else if (strcmp(utilname, "pkgrm") == 0) {
+		runfunc = helpwanted ? pkgrm_help : pkgrm_run;
+	} else if (optind < argc && strcmp(argv[optind], "daemon") == 0) {
+		// 'cpkg daemon [options]'; the daemon sees "daemon" as argv[0]
+		runfunc = helpwanted ? pkgdaemon_help : pkgdaemon_run;
+		argc -= optind;
+		argv += optind;
+	} else if (optind < argc && strcmp(argv[optind], "fold") == 0) {
+		// 'cpkg fold [options]'
+		runfunc = helpwanted ? pkgfold_help : pkgfold_run;
+		argc -= optind;
+		argv += optind;
 	} else {
 		printf("no util specified; cpkg mode.\n");
 	}
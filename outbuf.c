@@ -0,0 +1,163 @@
+/*
+	outbuf.c
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "outbuf.h"
+
+
+struct outbuf *outbuf_new(int fd) {
+
+	struct outbuf *out = calloc(1, sizeof(struct outbuf));
+
+	out->fd = fd;
+	out->size = OUTBUFSIZE;
+	out->buf = malloc(out->size);
+
+	if (out->buf == NULL) {
+		printf("Failed to allocate memory!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return(out);
+}
+
+
+// writes iovcnt buffers to the file descriptor, retrying short writes
+static void out_writev(struct outbuf *out, struct iovec *iov, int iovcnt) {
+
+	ssize_t r;
+
+	while (iovcnt > 0 && !out->error) {
+		if ((r = writev(out->fd, iov, iovcnt)) < 0) {
+			if (errno == EINTR)
+				continue;
+			out->error = 1;
+			break;
+		}
+		while (iovcnt > 0 && r >= iov->iov_len) {
+			r -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + r;
+			iov->iov_len -= r;
+		}
+	}
+}
+
+
+void out_write(struct outbuf *out, const char *s, size_t n) {
+
+	if (out->size - out->len >= n) {
+		memcpy(out->buf + out->len, s, n);
+		out->len += n;
+		return;
+	}
+
+	if (out->fd == -1) {
+		// in-memory buffer, grow it
+		while (out->size - out->len < n) {
+			out->size *= 2;
+		}
+		if ((out->buf = realloc(out->buf, out->size)) == NULL) {
+			printf("Failed to allocate memory!\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(out->buf + out->len, s, n);
+		out->len += n;
+		return;
+	}
+
+	if (n < out->size) {
+		// fill the buffer, write it out and keep the rest
+		size_t part = out->size - out->len;
+		memcpy(out->buf + out->len, s, part);
+		out->len = out->size;
+		out_flush(out);
+		memcpy(out->buf, s + part, n - part);
+		out->len = n - part;
+		return;
+	}
+
+	// a large block goes out together with what is buffered, uncopied
+	struct iovec iov[2] = {
+		{ out->buf, out->len },
+		{ (char *)s, n }
+	};
+	fflush(stdout);
+	out_writev(out, iov, 2);
+	out->len = 0;
+}
+
+
+void out_puts(struct outbuf *out, const char *s) {
+	out_write(out, s, strlen(s));
+}
+
+
+void out_putc(struct outbuf *out, char c) {
+
+	if (out->len == out->size)
+		out_write(out, &c, 1);
+	else
+		out->buf[out->len++] = c;
+}
+
+
+void out_putint(struct outbuf *out, long n) {
+
+	char tmp[24];
+	int c = sizeof(tmp);
+	unsigned long u = n < 0 ? -(unsigned long)n : (unsigned long)n;
+
+	do {
+		tmp[--c] = '0' + u % 10;
+		u /= 10;
+	} while (u > 0);
+
+	if (n < 0)
+		tmp[--c] = '-';
+
+	out_write(out, tmp + c, sizeof(tmp) - c);
+}
+
+
+void out_pad(struct outbuf *out, const char *s, int width) {
+
+	size_t len = strlen(s);
+
+	out_write(out, s, len);
+	for (; width > 0 && len < (size_t)width; len++) {
+		out_putc(out, ' ');
+	}
+}
+
+
+void out_flush(struct outbuf *out) {
+
+	if (out->fd == -1 || out->len == 0)
+		return;
+
+	// anything already printed through stdio goes first
+	fflush(stdout);
+
+	struct iovec iov = { out->buf, out->len };
+	out_writev(out, &iov, 1);
+	out->len = 0;
+}
+
+
+void outbuf_free(struct outbuf *out) {
+
+	out_flush(out);
+	free(out->buf);
+	free(out);
+}
@@ -0,0 +1,79 @@
+/*
+	outbuf.h
+*/
+
+#ifndef _OUTBUF_H_
+#define _OUTBUF_H_
+
+#include <stddef.h>
+
+// size of the output buffer; data is written out in blocks of this size
+#define OUTBUFSIZE 262144
+
+// buffered output to a file descriptor, or to memory when fd is -1
+struct outbuf {
+	int fd;
+	char *buf;
+	size_t len, size;
+	int error; // a write failed; further output is dropped
+};
+
+/*
+	outbuf_new: returns an output buffer writing to fd, or collecting the
+		output in memory if fd is -1
+*/
+
+struct outbuf *outbuf_new(int fd);
+
+
+/*
+	out_write: appends n bytes to the output buffer
+*/
+
+void out_write(struct outbuf *out, const char *s, size_t n);
+
+
+/*
+	out_puts: appends a string to the output buffer
+*/
+
+void out_puts(struct outbuf *out, const char *s);
+
+
+/*
+	out_putc: appends a character to the output buffer
+*/
+
+void out_putc(struct outbuf *out, char c);
+
+
+/*
+	out_putint: appends the decimal representation of n to the output
+		buffer
+*/
+
+void out_putint(struct outbuf *out, long n);
+
+
+/*
+	out_pad: appends s padded with spaces to at least width characters
+*/
+
+void out_pad(struct outbuf *out, const char *s, int width);
+
+
+/*
+	out_flush: writes the buffered output to the file descriptor; does
+		nothing for in-memory buffers
+*/
+
+void out_flush(struct outbuf *out);
+
+
+/*
+	outbuf_free: flushes the output buffer and frees it
+*/
+
+void outbuf_free(struct outbuf *out);
+
+#endif
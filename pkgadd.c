@@ -0,0 +1,479 @@
+/*
+	pkgadd.c
+*/
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "hashmap.h"
+#include "pkgadd.h"
+#include "pkgjournal.h"
+#include "pkgutil.h"
+
+// a regular file read from the package, waiting to be written
+struct extractjob {
+	struct archive_entry *entry;
+	char *data;
+	size_t size;
+	struct extractjob *next;
+};
+
+// bounded queue of file writes shared by the extraction workers
+struct extractpool {
+	struct extractjob *head, *tail;
+	size_t queued;           // bytes of file data in the queue
+	int pending;             // jobs queued or being written
+	int closed;              // no more jobs will be queued
+	int failed;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;    // a job was queued, or the queue was closed
+	pthread_cond_t room;     // a job was written
+};
+
+// one extraction worker and the libarchive disk writer it owns
+struct extractworker {
+	struct extractpool *pool;
+	struct archive *disk;
+	pthread_t thread;
+	int threaded;
+};
+
+
+// returns a libarchive disk writer restoring permissions and times, and
+// ownership when running as root; it won't write through '..' or through
+// a symlink on disk
+static struct archive *new_disk_writer() {
+
+	struct archive *disk = archive_write_disk_new();
+	int flags = ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_SECURE_NODOTDOT
+		| ARCHIVE_EXTRACT_SECURE_SYMLINKS;
+
+	if (geteuid() == 0)
+		flags |= ARCHIVE_EXTRACT_OWNER;
+	archive_write_disk_set_options(disk, flags);
+	archive_write_disk_set_standard_lookup(disk);
+
+	return(disk);
+}
+
+
+// writes one entry and its data through disk; returns 0 or -1
+static int write_entry(struct archive *disk, struct archive_entry *entry, const char *data, size_t size) {
+
+	if (archive_write_header(disk, entry) < ARCHIVE_WARN
+			|| (size > 0 && archive_write_data(disk, data, size) != size)
+			|| archive_write_finish_entry(disk) < ARCHIVE_WARN) {
+		printf("pkgadd: could not install '%s': %s\n", archive_entry_pathname(entry), archive_error_string(disk));
+		return(-1);
+	}
+
+	return(0);
+}
+
+
+/*
+	stream_entry: writes entry through disk with its data copied from a a
+		block at a time, for files too large to hold in memory; returns 0,
+		-1 if it could not be written, or -2 if a could not be read
+*/
+
+static int stream_entry(struct archive *a, struct archive *disk, struct archive_entry *entry) {
+
+	const void *buf;
+	size_t size;
+	la_int64_t offset;
+	int r;
+
+	if (archive_write_header(disk, entry) < ARCHIVE_WARN)
+		goto failed;
+	while ((r = archive_read_data_block(a, &buf, &size, &offset)) == ARCHIVE_OK) {
+		if (archive_write_data_block(disk, buf, size, offset) < ARCHIVE_WARN)
+			goto failed;
+	}
+	if (archive_write_finish_entry(disk) < ARCHIVE_WARN)
+		goto failed;
+
+	return(r == ARCHIVE_EOF ? 0 : -2);
+
+failed:
+	printf("pkgadd: could not install '%s': %s\n", archive_entry_pathname(entry), archive_error_string(disk));
+	return(-1);
+}
+
+
+static void *extract_worker(void *arg) {
+
+	struct extractworker *worker = arg;
+	struct extractpool *pool = worker->pool;
+	struct extractjob *job;
+	int r;
+
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		while (pool->head == NULL && !pool->closed) {
+			pthread_cond_wait(&pool->ready, &pool->lock);
+		}
+		if ((job = pool->head) == NULL) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		if ((pool->head = job->next) == NULL)
+			pool->tail = NULL;
+		pthread_mutex_unlock(&pool->lock);
+
+		r = write_entry(worker->disk, job->entry, job->data, job->size);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->queued -= job->size;
+		pool->pending--;
+		if (r == -1)
+			pool->failed++;
+		pthread_cond_broadcast(&pool->room);
+		pthread_mutex_unlock(&pool->lock);
+
+		archive_entry_free(job->entry);
+		free(job->data);
+		free(job);
+	}
+
+	return(NULL);
+}
+
+
+// queues a file write, waiting while the queue holds too much data
+static void queue_job(struct extractpool *pool, struct extractjob *job) {
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->queued > 0 && pool->queued + job->size > PKGADDQUEUE) {
+		pthread_cond_wait(&pool->room, &pool->lock);
+	}
+	if (pool->tail != NULL)
+		pool->tail->next = job;
+	else
+		pool->head = job;
+	pool->tail = job;
+	pool->queued += job->size;
+	pool->pending++;
+	pthread_cond_signal(&pool->ready);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+// waits until every queued file has been written
+static void drain_jobs(struct extractpool *pool) {
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending > 0) {
+		pthread_cond_wait(&pool->room, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+/*
+	extract_package: extracts the package file filename under root; the
+		archive is read on this thread, which also creates directories,
+		links and special files in archive order, and streams files larger
+		than PKGADDSTREAM to disk, while up to jobs worker threads write the
+		other regular files; returns the number of failures
+*/
+
+static int extract_package(char *filename, char *root, int jobs) {
+
+	struct archive *a, *disk;
+	struct archive_entry *entry;
+	struct extractpool pool;
+	struct extractworker *workers;
+	char path[PATH_MAX];
+	int c, r, cwd, threads = 0, failed = 0;
+
+	if ((a = open_package_archive(filename, 0)) == NULL) {
+		printf("pkgadd: could not open '%s'\n", filename);
+		return(1);
+	}
+
+	// extract relative to root, so only symlinks below it are refused
+	if ((cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 || chdir(*root ? root : "/") == -1) {
+		printf("pkgadd: could not change to '%s'\n", *root ? root : "/");
+		archive_read_free(a);
+		return(1);
+	}
+
+	memset(&pool, 0, sizeof(pool));
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.ready, NULL);
+	pthread_cond_init(&pool.room, NULL);
+
+	// the disk writers are all made here: creating one reads the umask by
+	// setting it, which must not race with files being created
+	if (jobs <= 0)
+		jobs = default_jobs();
+	disk = new_disk_writer();
+	workers = calloc(jobs, sizeof(struct extractworker));
+	for (c = 0; c < jobs; c++) {
+		workers[c].pool = &pool;
+		workers[c].disk = new_disk_writer();
+	}
+	for (c = 0; c < jobs; c++) {
+		workers[c].threaded = (pthread_create(&workers[c].thread, NULL, extract_worker, &workers[c]) == 0);
+		threads += workers[c].threaded;
+	}
+
+	while ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
+		snprintf(path, sizeof(path), "./%s", archive_entry_pathname(entry));
+		archive_entry_set_pathname(entry, path);
+
+		if (archive_entry_hardlink(entry) != NULL) {
+			// the link target may still be queued
+			snprintf(path, sizeof(path), "./%s", archive_entry_hardlink(entry));
+			archive_entry_set_hardlink(entry, path);
+			drain_jobs(&pool);
+			if (write_entry(disk, entry, NULL, 0) == -1)
+				failed++;
+		} else if (archive_entry_filetype(entry) == AE_IFREG && archive_entry_size(entry) > 0) {
+			size_t size = archive_entry_size(entry);
+			char *data = NULL;
+
+			// large files, or ones there's no memory to buffer, are written
+			// here as they are read
+			if (size > PKGADDSTREAM || (data = malloc(size)) == NULL) {
+				int s = stream_entry(a, disk, entry);
+				if (s == -1) {
+					failed++;
+				} else if (s == -2) {
+					printf("pkgadd: could not read '%s' from '%s'\n", archive_entry_pathname(entry), filename);
+					failed++;
+					break;
+				}
+				continue;
+			}
+
+			// read the data here and leave the writing to a worker
+			struct extractjob *job = calloc(1, sizeof(struct extractjob));
+			job->size = size;
+			job->data = data;
+			if (archive_read_data(a, job->data, job->size) != job->size) {
+				printf("pkgadd: could not read '%s' from '%s'\n", archive_entry_pathname(entry), filename);
+				free(job->data);
+				free(job);
+				failed++;
+				break;
+			}
+			if (threads > 0) {
+				job->entry = archive_entry_clone(entry);
+				queue_job(&pool, job);
+			} else {
+				// no worker could be started
+				if (write_entry(disk, entry, job->data, job->size) == -1)
+					failed++;
+				free(job->data);
+				free(job);
+			}
+		} else {
+			// directories, symlinks, special and empty files, in order
+			if (write_entry(disk, entry, NULL, 0) == -1)
+				failed++;
+		}
+	}
+	// a file that could not be read has been reported already, and left
+	// r at ARCHIVE_OK
+	if (r != ARCHIVE_EOF && r != ARCHIVE_OK) {
+		printf("pkgadd: could not read '%s'\n", filename);
+		failed++;
+	}
+
+	// let the workers finish the queue
+	pthread_mutex_lock(&pool.lock);
+	pool.closed = 1;
+	pthread_cond_broadcast(&pool.ready);
+	pthread_mutex_unlock(&pool.lock);
+	for (c = 0; c < jobs; c++) {
+		if (workers[c].threaded)
+			pthread_join(workers[c].thread, NULL);
+		archive_write_free(workers[c].disk);
+	}
+	failed += pool.failed;
+
+	// directory permissions and times are restored when the writer closes
+	if (archive_write_close(disk) != ARCHIVE_OK)
+		failed++;
+	archive_write_free(disk);
+	archive_read_free(a);
+	if (fchdir(cwd) == -1)
+		failed++;
+	close(cwd);
+
+	pthread_mutex_destroy(&pool.lock);
+	pthread_cond_destroy(&pool.ready);
+	pthread_cond_destroy(&pool.room);
+	free(workers);
+
+	return(failed);
+}
+
+
+/*
+	find_conflicts: prints the files of pkg that an installed package owns
+		or that already exist under root, probing a hash set of every
+		installed path; directories may be shared; returns their number
+*/
+
+static int find_conflicts(struct packagedb *packagedb, struct package *pkg, char *root) {
+
+	struct hashmap *installed;
+	struct stat st;
+	char path[PATH_MAX];
+	int c, f, total = 0, conflicts = 0;
+
+	for (c = 0; c < packagedb->numpackages; c++) {
+		total += packagedb->packages[c]->numfiles;
+	}
+
+	installed = hashmap_new(total);
+	for (c = 0; c < packagedb->numpackages; c++) {
+		struct package *owner = packagedb->packages[c];
+		for (f = 0; f < owner->numfiles; f++) {
+			*hashmap_insert(installed, owner->files[f]) = owner;
+		}
+	}
+
+	for (f = 0; f < pkg->numfiles; f++) {
+		char *file = pkg->files[f];
+		if (file[0] != '\0' && file[strlen(file) - 1] == '/')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", root, file);
+		if (hashmap_get(installed, file) != NULL || lstat(path, &st) == 0) {
+			printf("%s\n", file);
+			conflicts++;
+		}
+	}
+
+	hashmap_free(installed);
+
+	return(conflicts);
+}
+
+
+static int path_cmp(const void *a, const void *b) {
+	return(strcmp(*(char **)a, *(char **)b));
+}
+
+
+int pkgadd_run(int argc, char *argv[]) {
+
+	// strings for passed options
+	char *o_root = "";
+	int o_force = 0, o_fold = 0, o_jobs = 0;
+
+	char pkgdb[PATH_MAX];
+	struct packagedb *packagedb;
+	struct package *pkg;
+	int failed;
+
+	// getopt(3) setup
+	int opt = 0, option_index = 1;
+	extern int optind, opterr, optopt;
+	opterr = 0;
+	optind = 0; // rescan from the start, with argument permutation reset
+
+	static struct option long_options[] = {
+		{ "force", no_argument,       NULL, 'f' },
+		{ "fold",  no_argument,       NULL, 'F' },
+		{ "jobs",  required_argument, NULL, 'j' },
+		{ "root",  required_argument, NULL, 'r' },
+		{ 0,       0,                 0,    0   }
+	};
+
+	while ((opt = getopt_long(argc, argv, ":fFj:r:", long_options, &option_index)) != -1) {
+		switch (opt) {
+			case 'f':
+				// install over conflicting files
+				o_force = 1;
+				break;
+			case 'F':
+				// fold the journal into the database before exiting
+				o_fold = 1;
+				break;
+			case 'j':
+				// number of extraction threads
+				o_jobs = atoi(optarg);
+				break;
+			case 'r':
+				// use alternate root
+				o_root = optarg;
+				break;
+			case ':':
+				printf("pkgadd: option -%c requires an argument.\n", optopt);
+				exit(1);
+		}
+	}
+
+	if (optind != argc - 1) {
+		printf("pkgadd: exactly one package file is required!\n");
+		exit(1);
+	}
+
+	snprintf(pkgdb, sizeof(pkgdb), "%s%s", o_root, PKGDB);
+
+	// one writer at a time, as with pkgutils; readers take no lock
+	if (lock_packagedb(pkgdb) == -1) {
+		printf("pkgadd: package database is currently locked by another process\n");
+		exit(1);
+	}
+
+	// file lists are stored sorted, as pkgutils does
+	pkg = create_package_from_archive(argv[optind]);
+	qsort(pkg->files, pkg->numfiles, sizeof(char *), path_cmp);
+
+	packagedb = read_packagedb(pkgdb);
+
+	if (package_in_packagedb(pkg->name, packagedb) != -1) {
+		printf("pkgadd: package '%s' already installed\n", pkg->name);
+		exit(1);
+	}
+
+	if (!o_force && find_conflicts(packagedb, pkg, o_root) > 0) {
+		printf("pkgadd: listed file(s) already installed (use -f to ignore and overwrite)\n");
+		exit(1);
+	}
+
+	// record the package, then install its files
+	add_package_to_packagedb(packagedb, pkg);
+	if (journal_add_package(packagedb, pkgdb, pkg, o_fold) == -1) {
+		printf("pkgadd: could not write the package database '%s'\n", pkgdb);
+		exit(1);
+	}
+
+	failed = extract_package(argv[optind], o_root, o_jobs);
+
+	free_packagedb(packagedb);
+
+	if (failed > 0)
+		exit(1);
+
+	return(0);
+}
+
+
+int pkgadd_help() {
+	printf("usage: pkgadd [options] <file>\n"
+		"options:\n"
+		"  -f, --force                 install over files that already exist\n"
+		"  -F, --fold                  fold the journal into the package database,\n"
+		"                              for tools that only read the database\n"
+		"  -r, --root <path>           specify alternative installation root\n"
+		"  -j, --jobs <n>              use <n> threads to write files\n"
+		"  -v, --version               print version and exit\n"
+		"  -h, --help                  print help and exit\n");
+	return(0);
+}
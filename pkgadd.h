@@ -0,0 +1,30 @@
+/*
+	pkgadd.h
+*/
+
+#ifndef _PKGADD_H_
+#define _PKGADD_H_
+
+// most file data read ahead of the extraction workers, in bytes
+#define PKGADDQUEUE (64 * 1024 * 1024)
+
+// files larger than this are written by the reading thread a block at a
+// time instead of being buffered for a worker, in bytes
+#define PKGADDSTREAM (8 * 1024 * 1024)
+
+/*
+	pkgadd_run: handles 'pkgadd' tasks: checks a package file for
+		conflicts with the installed packages, records it in the package
+		database and extracts it
+*/
+
+int pkgadd_run(int argc, char *argv[]);
+
+
+/*
+	pkgadd_help: prints help/usage for pkgadd
+*/
+
+int pkgadd_help();
+
+#endif
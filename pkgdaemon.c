@@ -0,0 +1,345 @@
+/*
+	pkgdaemon.c
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "outbuf.h"
+#include "pkgdaemon.h"
+#include "pkgquery.h"
+#include "pkgutil.h"
+
+// set by SIGINT and SIGTERM to stop serving
+static volatile sig_atomic_t stopping = 0;
+
+
+static void stop_daemon(int sig) {
+	stopping = 1;
+}
+
+
+// fills addr with the socket path for pkgdb; returns -1 if it doesn't fit
+static int socket_address(char *pkgdb, struct sockaddr_un *addr) {
+
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if (snprintf(addr->sun_path, sizeof(addr->sun_path), "%s%s", pkgdb, PKGDAEMONSUFFIX) >= sizeof(addr->sun_path))
+		return(-1);
+
+	return(0);
+}
+
+
+// writes all of iov to fd; returns 0, or -1 if the peer went away
+static int write_all(int fd, struct iovec *iov, int iovcnt) {
+
+	ssize_t r;
+
+	while (iovcnt > 0) {
+		if ((r = writev(fd, iov, iovcnt)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return(-1);
+		}
+		while (iovcnt > 0 && r >= iov->iov_len) {
+			r -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + r;
+			iov->iov_len -= r;
+		}
+	}
+
+	return(0);
+}
+
+
+// checks that the peer of fd runs as root or as the daemon's user
+static int trusted_peer(int fd) {
+
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+		return(0);
+
+	return(cred.uid == 0 || cred.uid == geteuid());
+}
+
+
+// answers the request of one client
+static void serve_client(int fd, struct pkgquery *query, int defjobs) {
+
+	char req[PKGDAEMONREQUEST], header[64], *arg;
+	size_t len = 0;
+	ssize_t r;
+	int status, jobs;
+
+	// read up to the terminating NUL
+	while (len == 0 || req[len - 1] != '\0') {
+		if (len == sizeof(req) || (r = read(fd, req + len, sizeof(req) - len)) <= 0)
+			return;
+		len += r;
+	}
+
+	// "<op> <jobs> <arg>"
+	jobs = strtol(req + 1, &arg, 10);
+	if (len < 4 || req[1] != ' ' || *arg != ' ')
+		return;
+	arg++;
+	if (jobs == 0)
+		jobs = defjobs;
+
+	struct outbuf *out = outbuf_new(-1);
+	status = pkgquery_run(query, req[0], arg, jobs, out) == 0 ? 0 : 1;
+
+	struct iovec iov[2];
+	iov[0].iov_base = header;
+	iov[0].iov_len = snprintf(header, sizeof(header), "%d %zu\n", status, out->len);
+	iov[1].iov_base = out->buf;
+	iov[1].iov_len = out->len;
+	write_all(fd, iov, 2);
+
+	outbuf_free(out);
+}
+
+
+int pkgdaemon_run(int argc, char *argv[]) {
+
+	char *o_root = NULL, *o_db = NULL;
+	int o_jobs = 0, o_compact = 0;
+	char pkgdb[PATH_MAX];
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	int fd, client;
+
+	// getopt(3) setup
+	int opt = 0, option_index = 1;
+	extern int optind, opterr, optopt;
+	opterr = 0;
+	optind = 0;
+
+	static struct option long_options[] = {
+		{ "compact", no_argument,       NULL, 'c' },
+		{ "db",      required_argument, NULL, 'd' },
+		{ "jobs",    required_argument, NULL, 'j' },
+		{ "root",    required_argument, NULL, 'r' },
+		{ 0,         0,                 0,    0   }
+	};
+
+	while ((opt = getopt_long(argc, argv, ":cd:j:r:", long_options, &option_index)) != -1) {
+		switch (opt) {
+			case 'c':
+				// keep the file lists front-coded in memory
+				o_compact = 1;
+				break;
+			case 'd':
+				// serve this package database instead of the installed one
+				o_db = optarg;
+				break;
+			case 'j':
+				// number of worker threads for pattern searches
+				o_jobs = atoi(optarg);
+				break;
+			case 'r':
+				// use alternate root
+				o_root = optarg;
+				break;
+			case ':':
+				printf("cpkg: option -%c requires an argument.\n", optopt);
+				exit(1);
+		}
+	}
+
+	if (o_db)
+		snprintf(pkgdb, sizeof(pkgdb), "%s", o_db);
+	else
+		snprintf(pkgdb, sizeof(pkgdb), "%s%s", o_root ? o_root : "", PKGDB);
+
+	if (socket_address(pkgdb, &addr) == -1) {
+		printf("cpkg: socket path for '%s' is too long\n", pkgdb);
+		exit(1);
+	}
+
+	// load the database before listening, so the first query is fast too
+	struct pkgquery *query = pkgquery_new(pkgdb);
+	query->compact = o_compact;
+	if (pkgquery_load(query) == -1) {
+		printf("%s\n", query->error);
+		exit(1);
+	}
+	index_owners(query->packagedb);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+		printf("cpkg: could not create a socket\n");
+		exit(1);
+	}
+
+	// refuse to take over the socket of a daemon that is still running
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+		printf("cpkg: a daemon is already serving '%s'\n", pkgdb);
+		exit(1);
+	}
+	close(fd);
+	unlink(addr.sun_path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 64) == -1) {
+		printf("cpkg: could not listen on '%s'\n", addr.sun_path);
+		exit(1);
+	}
+
+	// clients are served one at a time, so only the daemon's own user and
+	// root may connect; a long pattern search can't hold up the daemon for
+	// everyone, and other users' pkginfo reads the database itself
+	chmod(addr.sun_path, 0644);
+
+	// stop cleanly on SIGINT and SIGTERM; accept(2) isn't restarted
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_daemon;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+#ifdef DEBUG
+	printf("cpkg: serving '%s' on '%s'\n", pkgdb, addr.sun_path);
+#endif
+
+	// a client that stops talking mustn't hold up everyone else;
+	// pkgdaemon_query reads a whole reply before writing any of it out
+	struct timeval timeout = { 1, 0 };
+
+	while (!stopping) {
+		if ((client = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) == -1)
+			continue;
+		// the socket mode already keeps others out, unless it was reached
+		// before chmod(2) above
+		if (!trusted_peer(client)) {
+			close(client);
+			continue;
+		}
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		serve_client(client, query, o_jobs);
+		close(client);
+	}
+
+	unlink(addr.sun_path);
+	close(fd);
+	pkgquery_free(query);
+
+	return(0);
+}
+
+
+int pkgdaemon_help() {
+	printf("usage: cpkg daemon [options]\n"
+		"serves pkginfo -i, -l and -o queries from memory over <db>.sock\n"
+		"to root and the user running it\n"
+		"options:\n"
+		"  -r, --root <path>           specify alternative installation root\n"
+		"  -d, --db <path>             serve the package database <path> instead\n"
+		"                              of the installed one\n"
+		"  -c, --compact               keep file lists front-coded in memory;\n"
+		"                              smaller, but slower to search\n"
+		"  -j, --jobs <n>              default number of threads for pattern\n"
+		"                              searches\n"
+		"  -h, --help                  print help and exit\n");
+	return(0);
+}
+
+
+int pkgdaemon_query(char *pkgdb, char op, char *arg, int jobs, struct outbuf *out, int *status) {
+
+	struct sockaddr_un addr;
+	char buf[65536], *p;
+	size_t len = 0, length;
+	ssize_t r;
+	int fd;
+
+	if (arg == NULL)
+		arg = "";
+	if (strlen(arg) + 32 > PKGDAEMONREQUEST || socket_address(pkgdb, &addr) == -1)
+		return(-1);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+		return(-1);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(fd);
+		return(-1);
+	}
+
+	// "<op> <jobs> <arg>" and the terminating NUL
+	char header[32];
+	struct iovec iov[2];
+	iov[0].iov_base = header;
+	iov[0].iov_len = snprintf(header, sizeof(header), "%c %d ", op, jobs);
+	iov[1].iov_base = arg;
+	iov[1].iov_len = strlen(arg) + 1;
+
+	// MSG_NOSIGNAL isn't available to writev, so ignore SIGPIPE meanwhile
+	void (*sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+	r = write_all(fd, iov, 2);
+	signal(SIGPIPE, sigpipe);
+	if (r == -1) {
+		close(fd);
+		return(-1);
+	}
+
+	// "<status> <length>\n"; until it is complete the query can still be
+	// answered locally
+	while ((p = memchr(buf, '\n', len)) == NULL) {
+		if (len >= 64 || (r = read(fd, buf + len, sizeof(buf) - len)) <= 0) {
+			close(fd);
+			return(-1);
+		}
+		len += r;
+	}
+	if (sscanf(buf, "%d %zu", status, &length) != 2) {
+		close(fd);
+		return(-1);
+	}
+	len -= p + 1 - buf;
+
+	// take in the whole reply before writing any of it, so a slow reader
+	// of the output can't run into the daemon's send timeout
+	char *reply = malloc(length + 1);
+	if (reply == NULL) {
+		close(fd);
+		return(-1);
+	}
+	if (len > length)
+		len = length;
+	memcpy(reply, p + 1, len);
+	while (len < length) {
+		if ((r = read(fd, reply + len, length - len)) <= 0)
+			break;
+		len += r;
+	}
+	close(fd);
+
+	out_write(out, reply, len);
+	free(reply);
+	if (len < length) {
+		out_puts(out, "pkginfo: lost the connection to the package daemon\n");
+		*status = 1;
+	}
+
+	return(0);
+}
@@ -0,0 +1,46 @@
+/*
+	pkgdaemon.h
+*/
+
+#ifndef _PKGDAEMON_H_
+#define _PKGDAEMON_H_
+
+#include "outbuf.h"
+
+// suffix of the Unix socket the daemon listens on, next to the database
+#define PKGDAEMONSUFFIX ".sock"
+
+// longest request a client may send
+#define PKGDAEMONREQUEST 8192
+
+/*
+	protocol: a client connects and sends "<op> <jobs> <arg>" followed by a
+	NUL byte; the daemon replies "<status> <length>\n" and length bytes of
+	output, then closes the connection; status 0 is success and 1 means
+	pkginfo should exit with an error after printing the output
+*/
+
+/*
+	pkgdaemon_run: handles 'cpkg daemon', serving pkginfo queries against a
+		resident package database until interrupted
+*/
+
+int pkgdaemon_run(int argc, char *argv[]);
+
+
+/*
+	pkgdaemon_help: prints help/usage for 'cpkg daemon'
+*/
+
+int pkgdaemon_help();
+
+
+/*
+	pkgdaemon_query: sends a query to the daemon serving pkgdb and writes
+		its output to out, storing its status in status; returns 0, or -1
+		with nothing written if no daemon answered
+*/
+
+int pkgdaemon_query(char *pkgdb, char op, char *arg, int jobs, struct outbuf *out, int *status);
+
+#endif
@@ -0,0 +1,86 @@
+/*
+	pkgfold.c
+*/
+
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pkgfold.h"
+#include "pkgjournal.h"
+#include "pkgutil.h"
+
+
+int pkgfold_run(int argc, char *argv[]) {
+
+	char *o_root = NULL, *o_db = NULL;
+	char pkgdb[PATH_MAX], journal[PATH_MAX + 8];
+	struct packagedb *packagedb;
+
+	// getopt(3) setup
+	int opt = 0, option_index = 1;
+	extern int optind, opterr, optopt;
+	opterr = 0;
+	optind = 0;
+
+	static struct option long_options[] = {
+		{ "db",   required_argument, NULL, 'd' },
+		{ "root", required_argument, NULL, 'r' },
+		{ 0,      0,                 0,    0   }
+	};
+
+	while ((opt = getopt_long(argc, argv, ":d:r:", long_options, &option_index)) != -1) {
+		switch (opt) {
+			case 'd':
+				// fold this package database instead of the installed one
+				o_db = optarg;
+				break;
+			case 'r':
+				// use alternate root
+				o_root = optarg;
+				break;
+			case ':':
+				printf("cpkg: option -%c requires an argument.\n", optopt);
+				exit(1);
+		}
+	}
+
+	if (o_db)
+		snprintf(pkgdb, sizeof(pkgdb), "%s", o_db);
+	else
+		snprintf(pkgdb, sizeof(pkgdb), "%s%s", o_root ? o_root : "", PKGDB);
+
+	if (lock_packagedb(pkgdb) == -1) {
+		printf("cpkg: package database is currently locked by another process\n");
+		exit(1);
+	}
+
+	// nothing to do without a journal
+	snprintf(journal, sizeof(journal), "%s%s", pkgdb, PKGJOURNALSUFFIX);
+	if (access(journal, F_OK) == -1)
+		return(0);
+
+	packagedb = read_packagedb(pkgdb);
+	if (write_packagedb(packagedb, pkgdb) == -1) {
+		printf("cpkg: could not write the package database '%s'\n", pkgdb);
+		exit(1);
+	}
+	free_packagedb(packagedb);
+
+	return(0);
+}
+
+
+int pkgfold_help() {
+	printf("usage: cpkg fold [options]\n"
+		"folds the journal of pkgadd and pkgrm into the package database, for\n"
+		"tools that only read the database\n"
+		"options:\n"
+		"  -r, --root <path>           specify alternative installation root\n"
+		"  -d, --db <path>             fold the package database <path> instead\n"
+		"                              of the installed one\n"
+		"  -h, --help                  print help and exit\n");
+	return(0);
+}
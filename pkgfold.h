@@ -0,0 +1,22 @@
+/*
+	pkgfold.h
+*/
+
+#ifndef _PKGFOLD_H_
+#define _PKGFOLD_H_
+
+/*
+	pkgfold_run: handles 'cpkg fold', folding the journal into the package
+		database so tools that only read the database see every change
+*/
+
+int pkgfold_run(int argc, char *argv[]);
+
+
+/*
+	pkgfold_help: prints help/usage for 'cpkg fold'
+*/
+
+int pkgfold_help();
+
+#endif
@@ -0,0 +1,335 @@
+/*
+	pkgindex.c
+*/
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "pkgindex.h"
+#include "pkgjournal.h"
+#include "pkgutil.h"
+
+// entry used to sort the path table
+struct pathsort {
+	char *path;
+	uint32_t package, file;
+};
+
+
+static int pathsort_cmp(const void *a, const void *b) {
+	return(strcmp(((struct pathsort *)a)->path, ((struct pathsort *)b)->path));
+}
+
+
+/*
+	packagedb_sample: FNV-1a hash of the size and of the first and last
+		PKGIDXSAMPLE bytes of the package database; this is not a checksum,
+		the middle of the file is never read; an index is judged stale by
+		the inode, size and mtime (with nanoseconds) of the database, and
+		the sample only guards against a rewrite that keeps all of those
+*/
+
+static uint64_t packagedb_sample(int fd, off_t size) {
+
+	char buf[PKGIDXSAMPLE];
+	uint64_t sum = 14695981039346656037ULL;
+	off_t offsets[2] = { 0, size > PKGIDXSAMPLE ? size - PKGIDXSAMPLE : 0 };
+	ssize_t len;
+	int c, i;
+
+	for (c = 0; c < 8; c++) {
+		sum ^= (size >> (c * 8)) & 0xff;
+		sum *= 1099511628211ULL;
+	}
+
+	for (c = 0; c < 2; c++) {
+		if ((len = pread(fd, buf, PKGIDXSAMPLE, offsets[c])) < 0)
+			return(0);
+		for (i = 0; i < len; i++) {
+			sum ^= (unsigned char)buf[i];
+			sum *= 1099511628211ULL;
+		}
+	}
+
+	return(sum);
+}
+
+
+// checks that count entries of size bytes at offset fit in a file of len bytes
+static int section_fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t len) {
+	return(offset <= len && count <= (len - offset) / size);
+}
+
+
+struct packagedb *read_packagedb_index(char *pkgdb) {
+
+	int c, dbfd, fd;
+	uint32_t f;
+	char idxpath[PATH_MAX];
+	struct stat dbst, st;
+
+	snprintf(idxpath, sizeof(idxpath), "%s%s", pkgdb, PKGIDXSUFFIX);
+
+	if ((fd = open(idxpath, O_RDONLY)) == -1)
+		return(NULL);
+	if (fstat(fd, &st) == -1 || st.st_size < sizeof(struct pkgidx_header)) {
+		close(fd);
+		return(NULL);
+	}
+
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return(NULL);
+
+	struct pkgidx_header *hdr = (struct pkgidx_header *)map;
+	uint64_t len = st.st_size;
+
+	// the index must match the package database it sits next to
+	if ((dbfd = open(pkgdb, O_RDONLY)) == -1 || fstat(dbfd, &dbst) == -1
+			|| memcmp(hdr->magic, PKGIDXMAGIC, sizeof(PKGIDXMAGIC)) != 0
+			|| hdr->version != PKGIDXVERSION
+			|| hdr->dbsize != dbst.st_size
+			|| hdr->dbino != dbst.st_ino
+			|| hdr->dbmtime != dbst.st_mtim.tv_sec
+			|| hdr->dbmtimensec != dbst.st_mtim.tv_nsec
+			|| hdr->dbsample != packagedb_sample(dbfd, dbst.st_size)) {
+		goto stale;
+	}
+
+	// sanity check the section bounds before trusting any offset
+	if (!section_fits(hdr->pkgoff, hdr->numpackages, sizeof(struct pkgidx_package), len)
+			|| !section_fits(hdr->fileoff, hdr->numfiles, sizeof(uint32_t), len)
+			|| !section_fits(hdr->pathoff, hdr->numfiles, sizeof(struct pkgidx_path), len)
+			|| !section_fits(hdr->strsoff, hdr->strssize, 1, len)
+			|| hdr->strssize == 0 || map[hdr->strsoff + hdr->strssize - 1] != '\0') {
+		goto stale;
+	}
+
+	struct pkgidx_package *ipkgs = (struct pkgidx_package *)(map + hdr->pkgoff);
+	uint32_t *ifiles = (uint32_t *)(map + hdr->fileoff);
+	char *strs = map + hdr->strsoff;
+
+	struct packagedb *packagedb = calloc(1, sizeof(struct packagedb));
+	packagedb->arena = arena_new();
+	packagedb->packages = arena_alloc(packagedb->arena, hdr->numpackages * sizeof(struct package *));
+	struct package *pkgblock = arena_alloc(packagedb->arena, hdr->numpackages * sizeof(struct package));
+	char **fileblock = arena_alloc(packagedb->arena, hdr->numfiles * sizeof(char *));
+	packagedb->map = map;
+	packagedb->mapsize = len;
+
+	// point the packages and their file lists into the string pool
+	for (f = 0; f < hdr->numfiles; f++) {
+		if (ifiles[f] >= hdr->strssize)
+			goto corrupt;
+		fileblock[f] = strs + ifiles[f];
+	}
+
+	for (c = 0; c < hdr->numpackages; c++) {
+		struct package *pkg = &pkgblock[c];
+		if (ipkgs[c].name >= hdr->strssize || ipkgs[c].version >= hdr->strssize
+				|| ipkgs[c].firstfile > hdr->numfiles
+				|| ipkgs[c].numfiles > hdr->numfiles - ipkgs[c].firstfile) {
+			goto corrupt;
+		}
+		pkg->name = strs + ipkgs[c].name;
+		pkg->version = strs + ipkgs[c].version;
+		pkg->release = ipkgs[c].release;
+		pkg->files = fileblock + ipkgs[c].firstfile;
+		pkg->numfiles = ipkgs[c].numfiles;
+		packagedb->packages[c] = pkg;
+	}
+	packagedb->numpackages = hdr->numpackages;
+
+	// the sorted path table is used as-is by the owner index
+	struct pkgidx_path *ipaths = (struct pkgidx_path *)(map + hdr->pathoff);
+	for (f = 0; f < hdr->numfiles; f++) {
+		if (ipaths[f].package >= hdr->numpackages || ipaths[f].file >= ipkgs[ipaths[f].package].numfiles)
+			goto corrupt;
+	}
+	packagedb->pathtable = ipaths;
+
+	// the index only describes the database itself; a journal belonging to
+	// a newer generation makes it stale, and one holding records missing
+	// from the database is reported by the parser
+	packagedb->generation = dbst;
+	if (replay_packagedb_journal(packagedb, pkgdb, &dbst) != 0)
+		goto corrupt;
+
+	close(dbfd);
+
+#ifdef DEBUG
+	printf("Loaded %d packages from the package database index.\n", packagedb->numpackages);
+#endif
+
+	return(packagedb);
+
+corrupt:
+	packagedb->numpackages = 0;
+	free_packagedb(packagedb);
+	close(dbfd);
+	return(NULL);
+
+stale:
+	if (dbfd != -1)
+		close(dbfd);
+	munmap(map, len);
+	return(NULL);
+}
+
+
+int write_packagedb_index(struct packagedb *packagedb, char *pkgdb) {
+
+	int c, dbfd, fd;
+	uint32_t f, numfiles = 0;
+	uint64_t strssize = 0;
+	char idxpath[PATH_MAX], tmppath[PATH_MAX + 8];
+	struct stat dbst;
+	struct pkgidx_header hdr;
+
+	// the index describes the package database as it is on disk right now,
+	// which has to be the generation packagedb was read from
+	if ((dbfd = open(pkgdb, O_RDONLY)) == -1)
+		return(-1);
+	if (fstat(dbfd, &dbst) == -1 || dbst.st_dev != packagedb->generation.st_dev
+			|| dbst.st_ino != packagedb->generation.st_ino
+			|| dbst.st_size != packagedb->generation.st_size
+			|| dbst.st_mtim.tv_sec != packagedb->generation.st_mtim.tv_sec
+			|| dbst.st_mtim.tv_nsec != packagedb->generation.st_mtim.tv_nsec) {
+		close(dbfd);
+		return(-1);
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PKGIDXMAGIC, sizeof(PKGIDXMAGIC));
+	hdr.version = PKGIDXVERSION;
+	hdr.dbsize = dbst.st_size;
+	hdr.dbino = dbst.st_ino;
+	hdr.dbmtime = dbst.st_mtim.tv_sec;
+	hdr.dbmtimensec = dbst.st_mtim.tv_nsec;
+	hdr.dbsample = packagedb_sample(dbfd, dbst.st_size);
+	close(dbfd);
+
+	// size the tables and the string pool
+	for (c = 0; c < packagedb->numpackages; c++) {
+		struct package *pkg = packagedb->packages[c];
+		strssize += strlen(pkg->name) + strlen(pkg->version) + 2;
+		for (f = 0; f < pkg->numfiles; f++) {
+			strssize += strlen(pkg->files[f]) + 1;
+		}
+		numfiles += pkg->numfiles;
+	}
+	if (strssize == 0)
+		strssize = 1;
+
+	// string offsets are 32 bits wide
+	if (strssize > UINT32_MAX)
+		return(-1);
+
+	hdr.numpackages = packagedb->numpackages;
+	hdr.numfiles = numfiles;
+	hdr.pkgoff = sizeof(hdr);
+	hdr.fileoff = hdr.pkgoff + (uint64_t)hdr.numpackages * sizeof(struct pkgidx_package);
+	hdr.pathoff = hdr.fileoff + (uint64_t)numfiles * sizeof(uint32_t);
+	hdr.pathoff = (hdr.pathoff + 7) & ~7ULL;
+	hdr.strsoff = hdr.pathoff + (uint64_t)numfiles * sizeof(struct pkgidx_path);
+	hdr.strssize = strssize;
+
+	// build the whole index in memory, then write it out in one go
+	uint64_t idxsize = hdr.strsoff + strssize;
+	char *idx = calloc(1, idxsize);
+	if (idx == NULL)
+		return(-1);
+
+	memcpy(idx, &hdr, sizeof(hdr));
+	struct pkgidx_package *ipkgs = (struct pkgidx_package *)(idx + hdr.pkgoff);
+	uint32_t *ifiles = (uint32_t *)(idx + hdr.fileoff);
+	struct pkgidx_path *ipaths = (struct pkgidx_path *)(idx + hdr.pathoff);
+	char *strs = idx + hdr.strsoff;
+	uint32_t stroff = 0, fileidx = 0;
+
+	struct pathsort *paths = calloc(numfiles ? numfiles : 1, sizeof(struct pathsort));
+
+	for (c = 0; c < packagedb->numpackages; c++) {
+		struct package *pkg = packagedb->packages[c];
+
+		ipkgs[c].name = stroff;
+		stroff = stpcpy(strs + stroff, pkg->name) - strs + 1;
+		ipkgs[c].version = stroff;
+		stroff = stpcpy(strs + stroff, pkg->version) - strs + 1;
+		ipkgs[c].release = pkg->release;
+		ipkgs[c].firstfile = fileidx;
+		ipkgs[c].numfiles = pkg->numfiles;
+
+		for (f = 0; f < pkg->numfiles; f++) {
+			ifiles[fileidx] = stroff;
+			stroff = stpcpy(strs + stroff, pkg->files[f]) - strs + 1;
+			paths[fileidx].path = pkg->files[f];
+			paths[fileidx].package = c;
+			paths[fileidx].file = f;
+			fileidx++;
+		}
+	}
+
+	qsort(paths, numfiles, sizeof(struct pathsort), pathsort_cmp);
+	for (f = 0; f < numfiles; f++) {
+		ipaths[f].package = paths[f].package;
+		ipaths[f].file = paths[f].file;
+	}
+	free(paths);
+
+	// write to a temporary file and rename it over the old index
+	snprintf(idxpath, sizeof(idxpath), "%s%s", pkgdb, PKGIDXSUFFIX);
+	snprintf(tmppath, sizeof(tmppath), "%s.XXXXXX", idxpath);
+
+	if ((fd = mkstemp(tmppath)) == -1) {
+		free(idx);
+		return(-1);
+	}
+
+	uint64_t written = 0;
+	ssize_t r;
+	while (written < idxsize) {
+		if ((r = write(fd, idx + written, idxsize - written)) <= 0)
+			break;
+		written += r;
+	}
+	free(idx);
+
+	r = (written == idxsize && fchmod(fd, 0644) == 0) ? 0 : -1;
+	if (close(fd) == -1 || r == -1 || rename(tmppath, idxpath) == -1) {
+		unlink(tmppath);
+		return(-1);
+	}
+
+#ifdef DEBUG
+	printf("Wrote package database index '%s'.\n", idxpath);
+#endif
+
+	return(0);
+}
+
+
+struct packagedb *open_packagedb(char *pkgdb, char **error) {
+
+	struct packagedb *packagedb;
+
+	if ((packagedb = read_packagedb_index(pkgdb)) != NULL)
+		return(packagedb);
+
+	// no usable index; parse the database and try to leave an index behind;
+	// it may hold journal records as well, which replaying them over it
+	// again leaves as they are
+	if ((packagedb = load_packagedb(pkgdb, error)) == NULL)
+		return(NULL);
+	write_packagedb_index(packagedb, pkgdb);
+
+	return(packagedb);
+}
@@ -0,0 +1,83 @@
+/*
+	pkgindex.h
+*/
+
+#ifndef _PKGINDEX_H_
+#define _PKGINDEX_H_
+
+#include <stdint.h>
+
+#include "pkgutil.h"
+
+// suffix of the binary index kept next to a package database
+#define PKGIDXSUFFIX ".idx"
+
+// index file magic and format version
+#define PKGIDXMAGIC "CPKGIDX"
+#define PKGIDXVERSION 1
+
+// number of bytes hashed at each end of the package database for validation
+#define PKGIDXSAMPLE 65536
+
+// index file header; all offsets are from the start of the index file
+struct pkgidx_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t numpackages;
+	uint32_t numfiles;
+	uint32_t reserved;
+
+	// identity of the package database the index was built from
+	uint64_t dbsize;
+	uint64_t dbino;
+	int64_t dbmtime, dbmtimensec;
+	uint64_t dbsample; // hash of the ends of the file, not a checksum
+
+	uint64_t pkgoff;   // struct pkgidx_package[numpackages]
+	uint64_t fileoff;  // uint32_t[numfiles], string pool offsets in package order
+	uint64_t pathoff;  // struct pkgidx_path[numfiles], sorted by path
+	uint64_t strsoff;  // string pool of NUL-terminated strings
+	uint64_t strssize;
+};
+
+// package table entry
+struct pkgidx_package {
+	uint32_t name, version; // string pool offsets
+	int32_t release;
+	uint32_t firstfile;     // index of the first file in the file table
+	uint32_t numfiles;
+};
+
+// sorted path table entry
+struct pkgidx_path {
+	uint32_t package; // index in the package table
+	uint32_t file;    // index in that package's file list
+};
+
+/*
+	read_packagedb_index: returns a struct packagedb pointer loaded from
+		the binary index next to pkgdb, or NULL if there is no index or it
+		does not match the current package database
+*/
+
+struct packagedb *read_packagedb_index(char *pkgdb);
+
+
+/*
+	write_packagedb_index: writes the binary index for packagedb next to
+		pkgdb; returns 0 on success or -1 if it could not be written or
+		pkgdb is no longer the generation packagedb was read from
+*/
+
+int write_packagedb_index(struct packagedb *packagedb, char *pkgdb);
+
+
+/*
+	open_packagedb: returns a struct packagedb pointer for pkgdb, using the
+		binary index when it is current and rebuilding it otherwise, or
+		NULL with a static description of the problem in error
+*/
+
+struct packagedb *open_packagedb(char *pkgdb, char **error);
+
+#endif
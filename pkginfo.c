@@ -8,67 +8,233 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
+#include "outbuf.h"
+#include "pkgdaemon.h"
 #include "pkginfo.h"
+#include "pkgquery.h"
+#include "pkgrepo.h"
 #include "pkgutil.h"
 
+/*
+	add_filelist: appends the file names listed one per line in listfile,
+		or on standard input if it is '-', to a dynamic array
+*/
+
+static void add_filelist(char *listfile, char ***files, int *numfiles, int *arrsize) {
+
+	FILE *fp;
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t read;
+
+	fp = strcmp(listfile, "-") == 0 ? stdin : fopen(listfile, "r");
+	if (fp == NULL) {
+		printf("pkginfo: could not open '%s'\n", listfile);
+		exit(1);
+	}
+
+	while ((read = getline(&line, &len, fp)) != -1) {
+		if (read > 0 && line[read - 1] == '\n')
+			line[--read] = '\0';
+		if (read == 0)
+			continue;
+		if (*numfiles == *arrsize) {
+			*arrsize *= 2;
+			*files = realloc(*files, *arrsize * sizeof(char *));
+		}
+		(*files)[(*numfiles)++] = strdup(line);
+	}
+
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+}
+
+/*
+	run_batch: runs the queries read from standard input against one loaded
+		package database, each followed by a record delimiter; returns the
+		number of queries that failed
+*/
+
+static int run_batch(char *pkgdb, char sep, int jobs, int compact) {
+
+	struct pkgquery *query = pkgquery_new(pkgdb);
+	struct outbuf *out = outbuf_new(STDOUT_FILENO);
+	struct package *pkg;
+	char *line = NULL, *arg, *error;
+	size_t len = 0;
+	ssize_t read;
+	int failed = 0;
+
+	query->compact = compact;
+	while ((read = getdelim(&line, &len, sep, stdin)) != -1) {
+		if (read > 0 && line[read - 1] == sep)
+			line[--read] = '\0';
+		if (read == 0)
+			continue;
+
+		// "<op> <arg>", where the argument runs to the end of the command
+		arg = line + 1;
+		if (*arg == ' ')
+			arg++;
+
+		if (line[0] == QUERY_LIST && access(arg, F_OK) == 0) {
+			// a package file, as with -l
+			if ((pkg = read_package_archive(arg, 0, &error)) != NULL) {
+				list_files_in_package(pkg, out);
+				free_package(pkg);
+			} else {
+				out_puts(out, "pkginfo: '");
+				out_puts(out, arg);
+				out_puts(out, "': ");
+				out_puts(out, error);
+				out_putc(out, '\n');
+				failed++;
+			}
+		} else if (pkgquery_run(query, line[0], arg, jobs, out) == -1) {
+			failed++;
+		}
+
+		// end the record and hand it to the reader right away
+		out_putc(out, sep);
+		out_flush(out);
+	}
+
+	free(line);
+	outbuf_free(out);
+	pkgquery_free(query);
+
+	return(failed);
+}
+
 int pkginfo_run(int argc, char *argv[]) {
 
-	// generic count and index
-	int c, i;
+	// generic count
+	int c;
 
-	// package database struct pointer
-	struct packagedb *packagedb;
+	// buffered standard output
+	struct outbuf *out;
 
 	// strings for passed options
 	char *o_arg = NULL;
 	char *o_root = NULL;
+	char *o_db = NULL;
+	char *o_from = NULL;
+	char *o_outdir = NULL;
+	int o_jobs = 0;
+	int o_sort = 0;
+	int o_compact = 0;
+	char o_sep = '\n';
 
 	char pkgdb[PATH_MAX];
 
+	// used to tell a repository directory from an index file
+	struct stat st;
+
 	// flags for selected operating mode
-	int o_footprint_mode = 0, o_installed_mode = 0, o_list_mode = 0, o_owner_mode = 0;
+	int o_batch_mode = 0, o_footprint_mode = 0, o_installed_mode = 0, o_list_mode = 0, o_mkindex_mode = 0, o_owner_mode = 0;
 
 	// getopt(3) setup
 	int opt = 0, option_index = 1;
 	extern int optind, opterr, optopt;
 	opterr = 0;
-	optind = 1;
+	optind = 0; // rescan from the start, with argument permutation reset
 
 	static struct option long_options[] = {
+		{ "batch",     no_argument,       NULL, 'b' },
+		{ "compact",   no_argument,       NULL, 'c' },
+		{ "db",        required_argument, NULL, 'd' },
 		{ "footprint", required_argument, NULL, 'f' },
+		{ "from",      required_argument, NULL, 'F' },
 		{ "installed", no_argument,       NULL, 'i' },
+		{ "jobs",      required_argument, NULL, 'j' },
 		{ "list",      required_argument, NULL, 'l' },
+		{ "mkindex",   required_argument, NULL, 'm' },
 		{ "owner",     required_argument, NULL, 'o' },
+		{ "outdir",    required_argument, NULL, 'O' },
+		{ "repo",      required_argument, NULL, 'R' },
 		{ "root",      required_argument, NULL, 'r' },
+		{ "sort",      no_argument,       NULL, 's' },
+		{ "null",      no_argument,       NULL, 'z' },
 		{ 0,           0,                 0,    0   }
 	};
 
-	while ((opt = getopt_long(argc, argv, ":f:il:o:r:", long_options, &option_index)) != -1) {
+	while ((opt = getopt_long(argc, argv, ":bcd:f:F:ij:l:m:o:O:r:R:sz", long_options, &option_index)) != -1) {
 		switch (opt) {
+			case 'b':
+				// batch mode, queries read from standard input
+				o_batch_mode = 1;
+				break;
+			case 'c':
+				// keep file lists front-coded in batch mode
+				o_compact = 1;
+				break;
+			case 'd':
+				// query this package database instead of the installed one
+				free(o_db);
+				o_db = strdup(optarg);
+				break;
 			case 'f':
 				// footprint mode
 				o_arg = strdup(optarg);
 				o_footprint_mode = 1;
 				break;
+			case 'F':
+				// footprint mode, package files listed in a file
+				o_from = strdup(optarg);
+				o_footprint_mode = 1;
+				break;
 			case 'i':
 				// installed mode
 				o_installed_mode = 1;
 				break;
+			case 'j':
+				// number of worker threads
+				o_jobs = atoi(optarg);
+				break;
 			case 'l':
 				// list mode
 				o_list_mode = 1;
 				o_arg = strdup(optarg);
 				break;
+			case 'm':
+				// repository index mode
+				o_arg = strdup(optarg);
+				o_mkindex_mode = 1;
+				break;
 			case 'o':
 				// owner mode
 				o_arg = strdup(optarg);
 				o_owner_mode = 1;
 				break;
+			case 'O':
+				// write footprints to files in this directory
+				o_outdir = strdup(optarg);
+				break;
 			case 'r':
 				// use alternate root
 				o_root = strdup(optarg);
 				break;
+			case 'R':
+				// query a repository index, or the one in a directory
+				free(o_db);
+				if ((stat(optarg, &st) == 0) && S_ISDIR(st.st_mode)) {
+					o_db = malloc(strlen(optarg) + strlen(REPODB) + 2);
+					sprintf(o_db, "%s/%s", optarg, REPODB);
+				} else {
+					o_db = strdup(optarg);
+				}
+				break;
+			case 's':
+				// sort footprints by path
+				o_sort = 1;
+				break;
+			case 'z':
+				// NUL-separated batch queries and results
+				o_sep = '\0';
+				break;
 			case ':':
 				printf("pkginfo: option -%c requires an argument.\n", optopt);
 				exit(1);
@@ -76,33 +242,74 @@ int pkginfo_run(int argc, char *argv[]) {
 	}
 
 	// check that a useful number of options is passed
-	if (o_footprint_mode + o_installed_mode + o_list_mode + o_owner_mode > 1) {
-		printf("pkginfo: only one of -f, -i, -l, or -o may be specified!\n");
+	if (o_batch_mode + o_footprint_mode + o_installed_mode + o_list_mode + o_mkindex_mode + o_owner_mode > 1) {
+		printf("pkginfo: only one of -b, -f, -i, -l, -m, or -o may be specified!\n");
 		exit(1);
 	}
 
-	if (o_footprint_mode + o_installed_mode + o_list_mode + o_owner_mode == 0) {
-		printf("pkginfo: one of -f, -i, -l, or -o is required!\n");
+	if (o_batch_mode + o_footprint_mode + o_installed_mode + o_list_mode + o_mkindex_mode + o_owner_mode == 0) {
+		printf("pkginfo: one of -b, -f, -i, -l, -m, or -o is required!\n");
 		exit(1);
 	}
 
 	// modes which don't require opening the package database
 	if (o_footprint_mode == 1) {
-		// print the footprint of the specified package file
-		make_footprint(o_arg);
+		// print the footprints of the specified package files: the -f
+		// argument, any further arguments, and those listed with --from
+		int numfiles = 0, arrsize = ARRSIZE, failed;
+		char **files = calloc(arrsize, sizeof(char *));
+
+		if (o_arg != NULL)
+			files[numfiles++] = o_arg;
+		for (c = optind; c < argc; c++) {
+			if (numfiles == arrsize) {
+				arrsize *= 2;
+				files = realloc(files, arrsize * sizeof(char *));
+			}
+			files[numfiles++] = strdup(argv[c]);
+		}
+		if (o_from != NULL) {
+			add_filelist(o_from, &files, &numfiles, &arrsize);
+			free(o_from);
+		}
+
+		out = outbuf_new(STDOUT_FILENO);
+		failed = make_footprints(files, numfiles, o_outdir, o_sort, o_jobs, out);
+		outbuf_free(out);
+
+		for (c = 0; c < numfiles; c++) {
+			free(files[c]);
+		}
+		free(files);
+		free(o_outdir);
+
+		if (failed > 0)
+			exit(1);
+	} else if (o_mkindex_mode == 1) {
+		// index the package files in a repository directory
+		int failed = build_repo_index(o_arg, o_jobs);
 		free(o_arg);
+
+		if (failed != 0)
+			exit(1);
 	} else if (o_list_mode == 1 && (access(o_arg, F_OK) == 0)) {
 		// list files in the specified package file
 		struct package *pkg;
 		pkg = create_package_from_archive(o_arg);
-		list_files_in_package(pkg);
+		out = outbuf_new(STDOUT_FILENO);
+		list_files_in_package(pkg, out);
+		outbuf_free(out);
 		free_package(pkg);
 		free(o_arg);
 	} else {
 		// modes which require opening the package database
 
-		// use alternate root if specified
-		if (o_root) {
+		// use another database, or the one under an alternate root
+		if (o_db) {
+			snprintf(pkgdb, sizeof(pkgdb), "%s", o_db);
+			free(o_db);
+			free(o_root);
+		} else if (o_root) {
 			snprintf(pkgdb, strlen(o_root) + strlen(PKGDB) + 1, "%s%s", o_root, PKGDB);
 			free(o_root);
 		} else {
@@ -113,30 +320,41 @@ int pkginfo_run(int argc, char *argv[]) {
 		printf("pkginfo: using package database '%s'\n", pkgdb);
 #endif
 
-		// read the package database into memory
-		packagedb = read_packagedb(pkgdb);
+		if (o_batch_mode == 1) {
+			// many queries against one load of the package database
+			if (run_batch(pkgdb, o_sep, o_jobs, o_compact) > 0)
+				exit(1);
+			return(0);
+		}
 
-		if (o_installed_mode == 1) {
-			// installed mode - list all installed packages
-			for (c = 0; c < packagedb->numpackages; c++) {
-				printf("%s %s-%d\n", packagedb->packages[c]->name, packagedb->packages[c]->version, packagedb->packages[c]->release);
-			}
+		char op = o_installed_mode ? QUERY_INSTALLED : o_list_mode ? QUERY_LIST : QUERY_OWNER;
+		int status = 0;
+		out = outbuf_new(STDOUT_FILENO);
+
+		if (pkgdaemon_query(pkgdb, op, o_arg, o_jobs, out, &status) == 0) {
+			// answered from memory by a resident 'cpkg daemon'
 		} else if (o_list_mode == 1) {
-			// list mode - list files owned by the specified package
-			if ((i = package_in_packagedb(o_arg, packagedb)) == -1) {
-				printf("pkginfo: %s is neither an installed package nor a package file\n", o_arg);
-			} else {
-				list_files_in_package(packagedb->packages[i]);
+			// list mode - list files owned by the specified package; streams
+			// through the database and stops at the end of its record
+			if (list_package_in_packagedb(pkgdb, o_arg, out) == -1) {
+				out_puts(out, "pkginfo: ");
+				out_puts(out, o_arg);
+				out_puts(out, " is neither an installed package nor a package file\n");
 			}
-			free(o_arg);
 		} else {
-			// owner mode - list owners matching specified file pattern
-			list_file_owners(packagedb, o_arg);
-			free(o_arg);
+			// installed and owner modes; loads the package database, from
+			// its binary index when current
+			struct pkgquery *query = pkgquery_new(pkgdb);
+			status = pkgquery_run(query, op, o_arg, o_jobs, out) == 0 ? 0 : 1;
+			pkgquery_free(query);
 		}
 
-		// cleanup packagedb mem
-		free_packagedb(packagedb);
+		// cleanup output
+		outbuf_free(out);
+		free(o_arg);
+
+		if (status != 0)
+			exit(1);
 	}
 
 	return(0);
@@ -148,8 +366,25 @@ int pkginfo_help() {
 		"  -i, --installed             list installed packages\n"
 		"  -l, --list <package|file>   list files in <package> or <file>\n"
 		"  -o, --owner <pattern>       list owner(s) of file(s) matching <pattern>\n"
-		"  -f, --footprint <file>      print footprint for <file>\n"
+		"  -b, --batch                 run queries read from stdin, one per line:\n"
+		"                              'i', 'l <package|file>' or 'o <pattern>';\n"
+		"                              each result ends with an empty line\n"
+		"  -z, --null                  with -b, queries and results end with NUL\n"
+		"  -c, --compact               with -b, keep file lists front-coded in\n"
+		"                              memory\n"
+		"  -m, --mkindex <dir>         write an index of the package files in\n"
+		"                              <dir> to <dir>/repo.db\n"
+		"  -f, --footprint <file>...   print footprint for <file>(s)\n"
+		"  -F, --from <list>           print footprints for the files listed in\n"
+		"                              <list>, one per line ('-' for stdin)\n"
+		"  -O, --outdir <dir>          write footprints to <dir>/<file>.footprint\n"
+		"  -s, --sort                  sort the footprint by path\n"
 		"  -r, --root <path>           specify alternative installation root\n"
+		"  -d, --db <path>             query the package database <path> instead\n"
+		"                              of the installed one\n"
+		"  -R, --repo <index|dir>      query a repository index written by -m\n"
+		"  -j, --jobs <n>              use <n> threads for pattern searches,\n"
+		"                              footprints and indexing\n"
 		"  -v, --version               print version and exit\n"
 		"  -h, --help                  print help and exit\n");
 	return(0);
@@ -0,0 +1,385 @@
+/*
+	pkgjournal.c
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "outbuf.h"
+#include "pkgjournal.h"
+
+
+static int package_cmp(const void *a, const void *b) {
+	return(strcmp((*(struct package **)a)->name, (*(struct package **)b)->name));
+}
+
+
+// stores the record of type op ('=' or '>') naming the database
+// generation described by st in buf and returns its length
+static size_t journal_header(int op, struct stat *st, char *buf, size_t size) {
+	return(snprintf(buf, size, "%c%llu %lld %lld %ld\n\n", op, (unsigned long long)st->st_ino,
+		(long long)st->st_size, (long long)st->st_mtim.tv_sec, (long)st->st_mtim.tv_nsec));
+}
+
+
+// checks that a and b describe the same generation of a file
+static int same_generation(struct stat *a, struct stat *b) {
+	return(a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size
+		&& a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec);
+}
+
+
+// writes len bytes of buf to fd at offset; returns 0 or -1
+static int pwrite_all(int fd, const char *buf, size_t len, off_t offset) {
+
+	ssize_t r;
+
+	while (len > 0) {
+		if ((r = pwrite(fd, buf, len, offset)) <= 0)
+			return(-1);
+		buf += r;
+		len -= r;
+		offset += r;
+	}
+
+	return(0);
+}
+
+
+int read_packagedb_journal(char *pkgdb, struct stat *dbst, struct arena *arena, struct hashmap **records, size_t *size) {
+
+	char path[PATH_MAX], header[128];
+	struct stat st;
+	size_t len = 0, hlen;
+	ssize_t r;
+	int fd;
+	char *buf = NULL;
+
+	*records = NULL;
+	*size = 0;
+	hlen = journal_header('=', dbst, header, sizeof(header));
+
+	// the journal is small; read it whole, with room for a terminating NUL
+	snprintf(path, sizeof(path), "%s%s", pkgdb, PKGJOURNALSUFFIX);
+	if ((fd = open(path, O_RDONLY)) != -1) {
+		if (fstat(fd, &st) == 0) {
+			buf = arena_alloc(arena, st.st_size + 1);
+			while (len < st.st_size && (r = read(fd, buf + len, st.st_size - len)) > 0) {
+				len += r;
+			}
+		}
+		close(fd);
+	}
+
+	if (buf == NULL || len < hlen || memcmp(buf, header, hlen) != 0) {
+		// a writer has published a newer generation meanwhile
+		if (stat(pkgdb, &st) == -1 || !same_generation(&st, dbst))
+			return(-1);
+
+		// without a journal, or with one that has no records or was folded
+		// into this generation and is about to be removed, the database is
+		// complete as read
+		char *stop = buf ? memmem(buf, len, "\n\n", 2) : NULL;
+		if (len == 0 || (*buf == '=' && stop != NULL && stop + 2 == buf + len))
+			return(0);
+		hlen = journal_header('>', dbst, header, sizeof(header));
+		if (len >= hlen && memcmp(buf + len - hlen, header, hlen) == 0)
+			return(0);
+
+		// the database was rewritten by something that doesn't know the
+		// journal, and its records are missing from it
+		return(-2);
+	}
+
+	*records = hashmap_new(0);
+	*size = hlen;
+
+	char *end = buf + len, *rec, *stop, *line, *next, *s;
+	int numlines;
+
+	for (rec = buf + hlen; rec < end; rec = stop + 2) {
+		// a record ends at its blank line; without one it is torn
+		if ((*rec != '+' && *rec != '-') || (stop = memmem(rec, end - rec, "\n\n", 2)) == NULL)
+			break;
+
+		numlines = 1;
+		for (s = rec; (s = memchr(s, '\n', stop - s)) != NULL; s++) {
+			numlines++;
+		}
+		if (rec[1] == '\n' || (*rec == '-' && numlines != 1) || (*rec == '+' && numlines < 2))
+			break;
+
+		struct package *pkg = arena_alloc(arena, sizeof(struct package));
+		pkg->files = arena_alloc(arena, numlines * sizeof(char *));
+		*stop = '\0';
+
+		// terminate the lines in place: name, version-release, then files
+		for (line = rec + 1; line != NULL; line = next) {
+			if ((next = strchr(line, '\n')) != NULL)
+				*next++ = '\0';
+
+			if (pkg->name == NULL) {
+				pkg->name = line;
+			} else if (pkg->version == NULL) {
+				pkg->version = line;
+				if ((s = strrchr(line, '-')) != NULL) {
+					*s = '\0';
+					pkg->release = atoi(s + 1);
+				}
+			} else {
+				pkg->files[pkg->numfiles++] = line;
+			}
+		}
+
+		// only the last record for a package counts
+		*hashmap_insert(*records, pkg->name) = pkg;
+		*size = stop + 2 - buf;
+	}
+
+	return(0);
+}
+
+
+int replay_packagedb_journal(struct packagedb *packagedb, char *pkgdb, struct stat *dbst) {
+
+	struct hashmap *records;
+	struct package **packages, **added;
+	int a, c, r, numadded = 0, numpackages = 0;
+	size_t h;
+
+	if ((r = read_packagedb_journal(pkgdb, dbst, packagedb->arena, &records, &packagedb->journalsize)) != 0)
+		return(r);
+	if (records == NULL)
+		return(0);
+	if (records->count == 0) {
+		hashmap_free(records);
+		return(0);
+	}
+
+	added = malloc(records->count * sizeof(struct package *));
+	for (h = 0; h < records->size; h++) {
+		struct package *pkg = records->entries[h].value;
+		if (records->entries[h].key != NULL && pkg->version != NULL)
+			added[numadded++] = pkg;
+	}
+	qsort(added, numadded, sizeof(struct package *), package_cmp);
+
+	// merge the packages the journal doesn't mention with the ones it
+	// adds, keeping the database in name order
+	packages = arena_alloc(packagedb->arena, (packagedb->numpackages + numadded) * sizeof(struct package *));
+	for (c = 0, a = 0; c < packagedb->numpackages || a < numadded; ) {
+		if (c < packagedb->numpackages && hashmap_get(records, packagedb->packages[c]->name) != NULL) {
+			free_package(packagedb->packages[c++]);
+		} else if (a < numadded && (c == packagedb->numpackages || strcmp(added[a]->name, packagedb->packages[c]->name) < 0)) {
+			packages[numpackages++] = added[a++];
+		} else {
+			packages[numpackages++] = packagedb->packages[c++];
+		}
+	}
+
+	packagedb->packagessize = packagedb->numpackages + numadded;
+	packagedb->packages = packages;
+	packagedb->numpackages = numpackages;
+	drop_indexes(packagedb);
+
+#ifdef DEBUG
+	printf("Replayed %zu journal records of the package database.\n", records->count);
+#endif
+
+	hashmap_free(records);
+	free(added);
+
+	return(0);
+}
+
+
+int seal_packagedb_journal(char *pkgdb, struct stat *st) {
+
+	char path[PATH_MAX], marker[128];
+	size_t len;
+	int fd, r;
+
+	snprintf(path, sizeof(path), "%s%s", pkgdb, PKGJOURNALSUFFIX);
+	if ((fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC)) == -1)
+		return(errno == ENOENT ? 0 : -1);
+
+	len = journal_header('>', st, marker, sizeof(marker));
+	r = (write(fd, marker, len) == (ssize_t)len && fdatasync(fd) == 0) ? 0 : -1;
+	close(fd);
+
+	return(r);
+}
+
+
+int lock_packagedb(char *pkgdb) {
+
+	char dir[PATH_MAX];
+	int fd;
+
+	// the descriptor is left open, so the lock lasts until exit
+	snprintf(dir, sizeof(dir), "%s", pkgdb);
+	if ((fd = open(dirname(dir), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+		return(-1);
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		close(fd);
+		return(-1);
+	}
+
+	return(0);
+}
+
+
+/*
+	write_journal: writes a new journal for the current generation of pkgdb
+		holding the complete records of the old one, if it extends that
+		generation, followed by rec, and renames it into place; returns 0
+		on success or -1
+*/
+
+static int write_journal(struct packagedb *packagedb, char *pkgdb, char *path, struct outbuf *rec) {
+
+	char tmppath[PATH_MAX + 8], header[128];
+	struct stat dbst;
+	size_t len;
+	int fd, oldfd = -1, r = -1;
+	char *old = NULL;
+
+	if (stat(pkgdb, &dbst) == -1)
+		return(-1);
+
+	snprintf(tmppath, sizeof(tmppath), "%s.XXXXXX", path);
+	if ((fd = mkstemp(tmppath)) == -1)
+		return(-1);
+
+	if (packagedb->journalsize > 0) {
+		// keep what was read, and leave the torn tail behind
+		len = packagedb->journalsize;
+		old = malloc(len);
+		if ((oldfd = open(path, O_RDONLY)) == -1 || pread(oldfd, old, len, 0) != (ssize_t)len || pwrite_all(fd, old, len, 0) == -1)
+			goto out;
+	} else {
+		len = journal_header('=', &dbst, header, sizeof(header));
+		if (pwrite_all(fd, header, len, 0) == -1)
+			goto out;
+	}
+
+	if (pwrite_all(fd, rec->buf, rec->len, len) == -1 || fchmod(fd, 0644) == -1 || fsync(fd) == -1)
+		goto out;
+	if (close(fd) == -1) {
+		fd = -1;
+		goto out;
+	}
+	fd = -1;
+	if (rename(tmppath, path) == -1 || sync_parent_dir(path) == -1)
+		goto out;
+
+	packagedb->journalsize = len + rec->len;
+	r = 0;
+
+out:
+	if (fd != -1)
+		close(fd);
+	if (oldfd != -1)
+		close(oldfd);
+	if (r == -1)
+		unlink(tmppath);
+	free(old);
+
+	return(r);
+}
+
+
+/*
+	append_record: appends the record in rec to the journal of pkgdb and
+		syncs it, then folds the journal into the database if fold is set
+		or it has grown too large; returns 0 on success or -1
+*/
+
+static int append_record(struct packagedb *packagedb, char *pkgdb, struct outbuf *rec, int fold) {
+
+	char path[PATH_MAX];
+	struct stat st;
+	int fd, r;
+
+	snprintf(path, sizeof(path), "%s%s", pkgdb, PKGJOURNALSUFFIX);
+
+	// append in place while the journal ends with its last complete record;
+	// readers see the new record whole or cut short, never anything else
+	if (packagedb->journalsize > 0 && (fd = open(path, O_WRONLY | O_CLOEXEC)) != -1) {
+		if (fstat(fd, &st) == 0 && (size_t)st.st_size == packagedb->journalsize) {
+			r = (pwrite_all(fd, rec->buf, rec->len, packagedb->journalsize) == 0 && fdatasync(fd) == 0) ? 0 : -1;
+			close(fd);
+			if (r == -1)
+				return(-1);
+			packagedb->journalsize += rec->len;
+		} else {
+			// a torn record was left by a crash
+			close(fd);
+			if (write_journal(packagedb, pkgdb, path, rec) == -1)
+				return(-1);
+		}
+	} else if (write_journal(packagedb, pkgdb, path, rec) == -1) {
+		return(-1);
+	}
+
+	if (stat(pkgdb, &st) == -1)
+		return(-1);
+	if (fold || (packagedb->journalsize > PKGJOURNALMIN && packagedb->journalsize > st.st_size / 4))
+		return(write_packagedb(packagedb, pkgdb));
+
+	return(0);
+}
+
+
+int journal_add_package(struct packagedb *packagedb, char *pkgdb, struct package *pkg, int fold) {
+
+	struct outbuf *rec = outbuf_new(-1);
+	struct fileiter it;
+	const char *path;
+	int r;
+
+	out_putc(rec, '+');
+	out_puts(rec, pkg->name);
+	out_putc(rec, '\n');
+	out_puts(rec, pkg->version);
+	out_putc(rec, '-');
+	out_putint(rec, pkg->release);
+	out_putc(rec, '\n');
+	fileiter_init(&it, pkg);
+	while ((path = fileiter_next(&it)) != NULL) {
+		out_puts(rec, path);
+		out_putc(rec, '\n');
+	}
+	out_putc(rec, '\n');
+
+	r = append_record(packagedb, pkgdb, rec, fold);
+	outbuf_free(rec);
+
+	return(r);
+}
+
+
+int journal_remove_package(struct packagedb *packagedb, char *pkgdb, char *name, int fold) {
+
+	struct outbuf *rec = outbuf_new(-1);
+	int r;
+
+	out_putc(rec, '-');
+	out_puts(rec, name);
+	out_puts(rec, "\n\n");
+
+	r = append_record(packagedb, pkgdb, rec, fold);
+	outbuf_free(rec);
+
+	return(r);
+}
@@ -0,0 +1,121 @@
+/*
+	pkgjournal.h
+*/
+
+#ifndef _PKGJOURNAL_H_
+#define _PKGJOURNAL_H_
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "hashmap.h"
+#include "pkgutil.h"
+
+// journal file kept next to the package database, <pkgdb>.journal
+#define PKGJOURNALSUFFIX ".journal"
+
+// the journal is folded into the package database once it is larger than
+// this and than a quarter of the database itself
+#define PKGJOURNALMIN (256 * 1024)
+
+/*
+	the journal holds the packages added and removed since the package
+	database was last written, in the database format, with the name line
+	of every record prefixed by its operation:
+
+		=ino size mtime nsec  +name            -name
+		<blank line>          version-release  <blank line>
+		                      files...
+		                      <blank line>
+
+	the '=' record comes first and names the generation of the database
+	the journal extends: every write of the database is a new file renamed
+	into place, so its inode, size and mtime identify it
+
+	writers fold the journal into the database once it has grown past
+	PKGJOURNALMIN, when asked to with pkgadd and pkgrm --fold, or with
+	'cpkg fold'; pkgutils and prt-get read and rewrite the database alone,
+	so they see journaled changes only once folded; before the folded
+	database is renamed into place, a '>' record naming its generation
+	is appended, so a journal ending with one for the current database
+	is already part of it and is ignored, as is a journal without
+	records; any other journal of an older generation holds changes
+	missing from a database rewritten by another tool, and reading the
+	database fails until it is dealt with
+
+	the journal is only changed in place by appending whole records, which
+	are then synced; a reader may see the last one cut short, and a
+	record without its blank line is ignored along with anything after
+	it; a journal that has to be started over, or has a torn record left
+	by a crash, is written anew and renamed into place; only the last
+	record for a package counts
+
+	writers hold the lock of the database directory, as pkgutils does;
+	readers take no locks
+*/
+
+/*
+	read_packagedb_journal: reads the journal extending the generation of
+		pkgdb described by dbst into records, a map from package name to
+		its last record, or sets it to NULL if there is none; a removal is
+		a package with a NULL version; the records are allocated in arena
+		and size is set to the length of the complete records; returns 0,
+		-1 if pkgdb was replaced by a newer generation meanwhile, or -2 if
+		the journal extends an older generation and its records are missing
+		from pkgdb
+*/
+
+int read_packagedb_journal(char *pkgdb, struct stat *dbst, struct arena *arena, struct hashmap **records, size_t *size);
+
+
+/*
+	replay_packagedb_journal: applies the journal of pkgdb to packagedb,
+		which was loaded from the generation described by dbst; the records
+		live in its arena; returns 0, -1 if pkgdb was replaced by a newer
+		generation and has to be loaded again, or -2 if the journal holds
+		records missing from pkgdb, as read_packagedb_journal
+*/
+
+int replay_packagedb_journal(struct packagedb *packagedb, char *pkgdb, struct stat *dbst);
+
+
+/*
+	seal_packagedb_journal: appends the '>' record naming the generation
+		described by st to the journal of pkgdb, if there is one, and syncs
+		it; called by write_packagedb before the database holding the
+		journal is renamed into place; returns 0 on success or -1
+*/
+
+int seal_packagedb_journal(char *pkgdb, struct stat *st);
+
+
+/*
+	lock_packagedb: takes the exclusive lock of the directory holding
+		pkgdb, which is held until the process exits; returns 0, or -1 if
+		another process holds it
+*/
+
+int lock_packagedb(char *pkgdb);
+
+
+/*
+	journal_add_package: appends a record of pkg being installed to the
+		journal of pkgdb, once packagedb holds it and with the lock held;
+		the journal is then folded into the database with write_packagedb
+		if fold is set or it has grown too large; returns 0 on success or
+		-1, leaving the record in the journal if only the fold failed
+*/
+
+int journal_add_package(struct packagedb *packagedb, char *pkgdb, struct package *pkg, int fold);
+
+
+/*
+	journal_remove_package: appends a record of the named package being
+		removed to the journal of pkgdb, once packagedb no longer holds it;
+		otherwise as journal_add_package
+*/
+
+int journal_remove_package(struct packagedb *packagedb, char *pkgdb, char *name, int fold);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+	pkgquery.c
+*/
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "outbuf.h"
+#include "pkgindex.h"
+#include "pkgjournal.h"
+#include "pkgquery.h"
+#include "pkgutil.h"
+
+struct pkgquery *pkgquery_new(char *pkgdb) {
+
+	struct pkgquery *query = calloc(1, sizeof(struct pkgquery));
+	query->pkgdb = strdup(pkgdb);
+
+	return(query);
+}
+
+
+int pkgquery_load(struct pkgquery *query) {
+
+	struct packagedb *packagedb;
+	struct stat st, jst;
+	char journal[PATH_MAX];
+
+	if (stat(query->pkgdb, &st) == -1) {
+		query->error = "Failed to open the package database!";
+		return(-1);
+	}
+
+	// the journal grows in place, or is replaced by a new file
+	snprintf(journal, sizeof(journal), "%s%s", query->pkgdb, PKGJOURNALSUFFIX);
+	if (stat(journal, &jst) == -1) {
+		memset(&jst, 0, sizeof(jst));
+		jst.st_size = -1;
+	}
+
+	// keep what is loaded while the files are the same
+	if (query->packagedb != NULL && st.st_dev == query->dev && st.st_ino == query->ino
+			&& st.st_size == query->size && st.st_mtim.tv_sec == query->mtime.tv_sec
+			&& st.st_mtim.tv_nsec == query->mtime.tv_nsec
+			&& jst.st_ino == query->journalino && jst.st_size == query->journalsize && jst.st_mtim.tv_sec == query->journalmtime.tv_sec
+			&& jst.st_mtim.tv_nsec == query->journalmtime.tv_nsec) {
+		return(0);
+	}
+
+	// the daemon lives on while the database is replaced, so keep the old
+	// generation until a new one has been read
+	if ((packagedb = open_packagedb(query->pkgdb, &query->error)) == NULL)
+		return(-1);
+	if (query->packagedb != NULL)
+		free_packagedb(query->packagedb);
+
+	query->packagedb = packagedb;
+	if (query->compact)
+		compact_packagedb(query->packagedb);
+	query->dev = st.st_dev;
+	query->ino = st.st_ino;
+	query->size = st.st_size;
+	query->mtime = st.st_mtim;
+	query->journalino = jst.st_ino;
+	query->journalsize = jst.st_size;
+	query->journalmtime = jst.st_mtim;
+
+	return(0);
+}
+
+
+int pkgquery_run(struct pkgquery *query, char op, char *arg, int jobs, struct outbuf *out) {
+
+	struct packagedb *packagedb;
+	int c;
+
+	if (pkgquery_load(query) == -1) {
+		out_puts(out, query->error);
+		out_putc(out, '\n');
+		return(-1);
+	}
+	packagedb = query->packagedb;
+
+	switch (op) {
+		case QUERY_INSTALLED:
+			// list all installed packages
+			for (c = 0; c < packagedb->numpackages; c++) {
+				out_puts(out, packagedb->packages[c]->name);
+				out_putc(out, ' ');
+				out_puts(out, packagedb->packages[c]->version);
+				out_putc(out, '-');
+				out_putint(out, packagedb->packages[c]->release);
+				out_putc(out, '\n');
+			}
+			break;
+		case QUERY_LIST:
+			// list files owned by the named package
+			if ((c = package_in_packagedb(arg, packagedb)) == -1) {
+				out_puts(out, "pkginfo: ");
+				out_puts(out, arg);
+				out_puts(out, " is neither an installed package nor a package file\n");
+				break;
+			}
+			list_files_in_package(packagedb->packages[c], out);
+			break;
+		case QUERY_OWNER:
+			// list owners of files matching the pattern
+			list_file_owners(packagedb, arg, jobs, out);
+			break;
+		default:
+			out_puts(out, "pkginfo: unknown query\n");
+			return(-1);
+	}
+
+	return(0);
+}
+
+
+void pkgquery_free(struct pkgquery *query) {
+
+	if (query->packagedb != NULL)
+		free_packagedb(query->packagedb);
+	free(query->pkgdb);
+	free(query);
+}
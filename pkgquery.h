@@ -0,0 +1,71 @@
+/*
+	pkgquery.h
+*/
+
+#ifndef _PKGQUERY_H_
+#define _PKGQUERY_H_
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "outbuf.h"
+
+// query operations, named after the pkginfo options
+#define QUERY_INSTALLED 'i'
+#define QUERY_LIST      'l'
+#define QUERY_OWNER     'o'
+
+// a package database kept loaded between queries
+struct pkgquery {
+	char *pkgdb;
+	struct packagedb *packagedb; // NULL until the first query
+	int compact;                 // front-code the file lists once loaded
+	char *error;                 // why the last load failed
+
+	// identity of the database file when it was loaded
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+
+	// identity of its journal; the size is -1 if there was none
+	ino_t journalino;
+	off_t journalsize;
+	struct timespec journalmtime;
+};
+
+/*
+	pkgquery_new: returns a query context for the package database pkgdb;
+		nothing is loaded until the first query
+*/
+
+struct pkgquery *pkgquery_new(char *pkgdb);
+
+
+/*
+	pkgquery_load: loads the package database, or reloads it if the file
+		or its journal changed since it was loaded; returns 0, or -1 with a
+		static description in query->error if it can't be read, in which
+		case a database loaded before stays loaded
+*/
+
+int pkgquery_load(struct pkgquery *query);
+
+
+/*
+	pkgquery_run: runs one query against the package database and writes
+		the result to out, as pkginfo would print it: op is QUERY_INSTALLED,
+		QUERY_LIST with a package name in arg, or QUERY_OWNER with a pattern
+		in arg; returns 0, or -1 after writing an error message to out
+*/
+
+int pkgquery_run(struct pkgquery *query, char op, char *arg, int jobs, struct outbuf *out);
+
+
+/*
+	pkgquery_free: frees the query context and its package database
+*/
+
+void pkgquery_free(struct pkgquery *query);
+
+#endif
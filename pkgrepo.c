@@ -0,0 +1,275 @@
+/*
+	pkgrepo.c
+*/
+
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hashmap.h"
+#include "pkgrepo.h"
+#include "pkgutil.h"
+
+// a package file in the repository directory
+struct repofile {
+	char *name;            // file name within the directory
+	long long size, mtime, mtimensec;
+	struct package *pkg;   // NULL until read or taken from the old index
+	int fresh;             // pkg was read in this run and must be freed
+};
+
+// what the previous index recorded about one of its packages
+struct repostamp {
+	char *name;
+	long long size, mtime, mtimensec;
+	struct package *pkg;
+};
+
+// shared state of the threads reading package files
+struct repobatch {
+	char *dir;
+	struct repofile *files;
+	int *todo;             // indexes of the files that need reading
+	int failed;
+	pthread_mutex_t lock;
+};
+
+
+static int repofile_cmp(const void *a, const void *b) {
+	return(strcmp(((struct repofile *)a)->name, ((struct repofile *)b)->name));
+}
+
+
+/*
+	load_stamps: loads the previous index and its stamps into a map from
+		file name to struct repostamp; stamps whose record doesn't belong to
+		the file they name are dropped, so a half-written pair of files
+		only costs rereads
+*/
+
+static struct hashmap *load_stamps(char *dbpath, char *stampspath, struct packagedb **olddb, struct repostamp **stamps, int *numstamps) {
+
+	FILE *fp;
+	char *line = NULL, *tab[3];
+	size_t len = 0;
+	ssize_t read;
+	struct hashmap *map;
+	struct pkgname pn;
+	char *error;
+	int c;
+
+	*olddb = NULL;
+	*stamps = NULL;
+	*numstamps = 0;
+	map = hashmap_new(0);
+
+	if (access(dbpath, F_OK) != 0 || (fp = fopen(stampspath, "r")) == NULL)
+		return(map);
+
+	*olddb = read_packagedb(dbpath);
+	*stamps = calloc((*olddb)->numpackages + 1, sizeof(struct repostamp));
+
+	while (*numstamps < (*olddb)->numpackages && (read = getline(&line, &len, fp)) != -1) {
+		struct package *pkg = (*olddb)->packages[*numstamps];
+		struct repostamp *st = &(*stamps)[*numstamps];
+
+		if (read > 0 && line[read - 1] == '\n')
+			line[--read] = '\0';
+
+		// <name>\t<size>\t<mtime>\t<nanoseconds>, split from the right
+		for (c = 2; c >= 0; c--) {
+			if ((tab[c] = strrchr(line, '\t')) == NULL)
+				break;
+			*tab[c] = '\0';
+		}
+		(*numstamps)++;
+		if (c >= 0 || parse_package_filename(line, &pn, &error) == -1
+				|| strlen(pkg->name) != pn.namelen || strncmp(pkg->name, pn.name, pn.namelen) != 0
+				|| strlen(pkg->version) != pn.versionlen || strncmp(pkg->version, pn.version, pn.versionlen) != 0
+				|| pkg->release != pn.release) {
+			continue;
+		}
+
+		st->name = strdup(line);
+		st->size = atoll(tab[0] + 1);
+		st->mtime = atoll(tab[1] + 1);
+		st->mtimensec = atoll(tab[2] + 1);
+		st->pkg = pkg;
+		*hashmap_insert(map, st->name) = st;
+	}
+
+	free(line);
+	fclose(fp);
+
+	return(map);
+}
+
+
+static void repo_worker(void *arg, int item) {
+
+	struct repobatch *rb = arg;
+	struct repofile *rf = &rb->files[rb->todo[item]];
+	char path[PATH_MAX], *error;
+
+	snprintf(path, sizeof(path), "%s/%s", rb->dir, rf->name);
+
+	// one decoder thread each; run_parallel spreads the files over the CPUs
+	if ((rf->pkg = read_package_archive(path, 1, &error)) == NULL) {
+		pthread_mutex_lock(&rb->lock);
+		printf("pkginfo: skipping '%s': %s\n", path, error);
+		rb->failed++;
+		pthread_mutex_unlock(&rb->lock);
+		return;
+	}
+	rf->fresh = 1;
+}
+
+
+/*
+	write_stamps: writes the stamps of the indexed files to path, replacing
+		the file atomically; returns 0 on success or -1
+*/
+
+static int write_stamps(char *path, struct repofile *files, int numfiles) {
+
+	char tmppath[PATH_MAX + 8];
+	int c, fd, r;
+	FILE *fp;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.XXXXXX", path);
+	if ((fd = mkstemp(tmppath)) == -1)
+		return(-1);
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		unlink(tmppath);
+		return(-1);
+	}
+
+	for (c = 0; c < numfiles; c++) {
+		if (files[c].pkg == NULL)
+			continue;
+		fprintf(fp, "%s\t%lld\t%lld\t%lld\n", files[c].name, files[c].size, files[c].mtime, files[c].mtimensec);
+	}
+
+	r = (ferror(fp) == 0 && fchmod(fd, 0644) == 0) ? 0 : -1;
+	if (fclose(fp) != 0 || r == -1 || rename(tmppath, path) == -1) {
+		unlink(tmppath);
+		return(-1);
+	}
+
+	return(0);
+}
+
+
+int build_repo_index(char *dir, int jobs) {
+
+	DIR *d;
+	struct dirent *de;
+	struct stat st;
+	struct pkgname pn;
+	char path[PATH_MAX], dbpath[PATH_MAX], stampspath[PATH_MAX], *error;
+	int c, numfiles = 0, arrsize = ARRSIZE, numtodo = 0, result;
+
+	if ((d = opendir(dir)) == NULL) {
+		printf("pkginfo: could not open directory '%s'\n", dir);
+		return(-1);
+	}
+
+	snprintf(dbpath, sizeof(dbpath), "%s/%s", dir, REPODB);
+	snprintf(stampspath, sizeof(stampspath), "%s/%s", dir, REPOSTAMPS);
+
+	// collect the package files, in name order so the index is stable
+	struct repofile *files = calloc(arrsize, sizeof(struct repofile));
+	while ((de = readdir(d)) != NULL) {
+		if (parse_package_filename(de->d_name, &pn, &error) == -1) {
+			if (strstr(de->d_name, ".pkg.tar.") != NULL)
+				printf("pkginfo: skipping '%s/%s': %s\n", dir, de->d_name, error);
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		if (stat(path, &st) == -1 || !S_ISREG(st.st_mode))
+			continue;
+		if (numfiles == arrsize) {
+			arrsize *= 2;
+			files = realloc(files, arrsize * sizeof(struct repofile));
+		}
+		memset(&files[numfiles], 0, sizeof(struct repofile));
+		files[numfiles].name = strdup(de->d_name);
+		files[numfiles].size = st.st_size;
+		files[numfiles].mtime = st.st_mtim.tv_sec;
+		files[numfiles].mtimensec = st.st_mtim.tv_nsec;
+		numfiles++;
+	}
+	closedir(d);
+	qsort(files, numfiles, sizeof(struct repofile), repofile_cmp);
+
+	// reuse the records of files whose size and mtime haven't changed
+	struct packagedb *olddb;
+	struct repostamp *stamps;
+	int numstamps;
+	struct hashmap *map = load_stamps(dbpath, stampspath, &olddb, &stamps, &numstamps);
+
+	int *todo = calloc(numfiles + 1, sizeof(int));
+	for (c = 0; c < numfiles; c++) {
+		struct repostamp *rs = hashmap_get(map, files[c].name);
+		if (rs != NULL && rs->size == files[c].size && rs->mtime == files[c].mtime && rs->mtimensec == files[c].mtimensec)
+			files[c].pkg = rs->pkg;
+		else
+			todo[numtodo++] = c;
+	}
+
+	// read the new and changed files
+	struct repobatch rb;
+	memset(&rb, 0, sizeof(rb));
+	rb.dir = dir;
+	rb.files = files;
+	rb.todo = todo;
+	pthread_mutex_init(&rb.lock, NULL);
+
+	run_parallel(jobs, numtodo, repo_worker, &rb);
+
+	pthread_mutex_destroy(&rb.lock);
+
+	// write the index, then the stamps describing it
+	struct packagedb repodb;
+	memset(&repodb, 0, sizeof(repodb));
+	repodb.packages = calloc(numfiles + 1, sizeof(struct package *));
+	for (c = 0; c < numfiles; c++) {
+		if (files[c].pkg != NULL)
+			repodb.packages[repodb.numpackages++] = files[c].pkg;
+	}
+
+	result = rb.failed;
+	if (write_packagedb(&repodb, dbpath) == -1 || write_stamps(stampspath, files, numfiles) == -1) {
+		printf("pkginfo: could not write the repository index '%s'\n", dbpath);
+		result = -1;
+	}
+
+#ifdef DEBUG
+	printf("pkginfo: indexed %d packages in '%s', %d read, %d failed\n", repodb.numpackages, dir, numtodo, rb.failed);
+#endif
+
+	// clean up
+	for (c = 0; c < numfiles; c++) {
+		if (files[c].fresh)
+			free_package(files[c].pkg);
+		free(files[c].name);
+	}
+	for (c = 0; c < numstamps; c++) {
+		free(stamps[c].name);
+	}
+	if (olddb != NULL)
+		free_packagedb(olddb);
+	hashmap_free(map);
+	free(repodb.packages);
+	free(stamps);
+	free(files);
+	free(todo);
+
+	return(result);
+}
@@ -0,0 +1,26 @@
+/*
+	pkgrepo.h
+*/
+
+#ifndef _PKGREPO_H_
+#define _PKGREPO_H_
+
+// repository index written into a directory of package files, in the
+// package database format
+#define REPODB "repo.db"
+
+// archive name, size and mtime of every record in the repository index,
+// one line each and in the same order; lets rebuilds skip unchanged files
+#define REPOSTAMPS "repo.db.stamps"
+
+/*
+	build_repo_index: writes <dir>/repo.db listing every package file in
+		dir, reading the files on up to jobs threads (0 for one per CPU);
+		files unchanged since the last run are taken from the old index;
+		returns the number of package files that could not be read, or -1
+		if the index could not be written
+*/
+
+int build_repo_index(char *dir, int jobs);
+
+#endif
@@ -0,0 +1,212 @@
+/*
+	pkgrm.c
+*/
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pkgindex.h"
+#include "pkgjournal.h"
+#include "pkgrm.h"
+#include "pkgutil.h"
+
+
+// returns the nth path of the package database in path order, and the
+// index of the package listing it in package
+static char *sorted_path(struct packagedb *packagedb, int n, int *package) {
+
+	if (packagedb->pathtable != NULL) {
+		*package = packagedb->pathtable[n].package;
+		return(packagedb->packages[*package]->files[packagedb->pathtable[n].file]);
+	}
+
+	*package = packagedb->owners[n].package;
+	return(packagedb->owners[n].path);
+}
+
+
+/*
+	shared_path: checks whether a package other than the one at index
+		lists path, by binary search of the paths of packagedb in path
+		order: the path table of its binary index when it was loaded from
+		a current one, or else the owner index; numpaths is their number
+*/
+
+static int shared_path(struct packagedb *packagedb, int numpaths, int index, const char *path) {
+
+	int lo = 0, hi = numpaths, mid, package;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(sorted_path(packagedb, mid, &package), path) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < numpaths && strcmp(sorted_path(packagedb, lo, &package), path) == 0; lo++) {
+		if (package != index)
+			return(1);
+	}
+
+	return(0);
+}
+
+
+static int reverse_path_cmp(const void *a, const void *b) {
+	return(strcmp(*(char **)b, *(char **)a));
+}
+
+
+/*
+	remove_files: deletes the files of the package at index under root
+		that no other package owns; only its own paths are looked up, so
+		this costs about its file count times log of the database's;
+		paths are visited in reverse sorted order, so everything in a
+		directory is gone before the directory itself; returns the number
+		of files that could not be removed
+*/
+
+static int remove_files(struct packagedb *packagedb, int index, char *root) {
+
+	struct package *pkg = packagedb->packages[index];
+	char path[PATH_MAX];
+	int c, f, numpaths = 0, failed = 0;
+
+	for (c = 0; c < packagedb->numpackages; c++) {
+		numpaths += packagedb->packages[c]->numfiles;
+	}
+	if (packagedb->pathtable == NULL)
+		index_owners(packagedb);
+
+	char **files = malloc((pkg->numfiles + 1) * sizeof(char *));
+	memcpy(files, pkg->files, pkg->numfiles * sizeof(char *));
+	qsort(files, pkg->numfiles, sizeof(char *), reverse_path_cmp);
+
+	for (f = 0; f < pkg->numfiles; f++) {
+		char *file = files[f];
+		size_t len = strlen(file);
+
+		if ((f > 0 && strcmp(file, files[f - 1]) == 0) || shared_path(packagedb, numpaths, index, file))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", root, file);
+
+		if (len > 0 && file[len - 1] == '/') {
+			// directories may still hold files nobody owns; leave those
+			if (rmdir(path) == -1 && errno != ENOENT && errno != ENOTEMPTY && errno != EEXIST) {
+				printf("pkgrm: could not remove '%s': %s\n", path, strerror(errno));
+				failed++;
+			}
+		} else if (unlink(path) == -1 && errno != ENOENT) {
+			printf("pkgrm: could not remove '%s': %s\n", path, strerror(errno));
+			failed++;
+		}
+	}
+
+	free(files);
+
+	return(failed);
+}
+
+
+int pkgrm_run(int argc, char *argv[]) {
+
+	// strings for passed options
+	char *o_root = "";
+
+	char pkgdb[PATH_MAX];
+	struct packagedb *packagedb;
+	struct package *pkg;
+	char *error;
+	int index, failed, o_fold = 0;
+
+	// getopt(3) setup
+	int opt = 0, option_index = 1;
+	extern int optind, opterr, optopt;
+	opterr = 0;
+	optind = 0;
+
+	static struct option long_options[] = {
+		{ "fold", no_argument,       NULL, 'F' },
+		{ "root", required_argument, NULL, 'r' },
+		{ 0,      0,                 0,    0   }
+	};
+
+	while ((opt = getopt_long(argc, argv, ":Fr:", long_options, &option_index)) != -1) {
+		switch (opt) {
+			case 'F':
+				// fold the journal into the database before exiting
+				o_fold = 1;
+				break;
+			case 'r':
+				// use alternate root
+				o_root = optarg;
+				break;
+			case ':':
+				printf("pkgrm: option -%c requires an argument.\n", optopt);
+				exit(1);
+		}
+	}
+
+	if (optind != argc - 1) {
+		printf("pkgrm: exactly one package name is required!\n");
+		exit(1);
+	}
+
+	snprintf(pkgdb, sizeof(pkgdb), "%s%s", o_root, PKGDB);
+
+	// one writer at a time, as with pkgutils; readers take no lock
+	if (lock_packagedb(pkgdb) == -1) {
+		printf("pkgrm: package database is currently locked by another process\n");
+		exit(1);
+	}
+
+	// a current binary index saves parsing the database, and its sorted
+	// path table is what the owners of the files are looked up in
+	if ((packagedb = open_packagedb(pkgdb, &error)) == NULL) {
+		printf("%s\n", error);
+		exit(1);
+	}
+
+	if ((index = package_in_packagedb(argv[optind], packagedb)) == -1) {
+		printf("pkgrm: package '%s' not installed\n", argv[optind]);
+		exit(1);
+	}
+
+	// delete the files while the package is still in the database, then
+	// record that it is gone, as pkgutils does
+	pkg = packagedb->packages[index];
+	failed = remove_files(packagedb, index, o_root);
+
+	remove_package_from_packagedb(packagedb, index);
+	if (journal_remove_package(packagedb, pkgdb, pkg->name, o_fold) == -1) {
+		printf("pkgrm: could not write the package database '%s'\n", pkgdb);
+		exit(1);
+	}
+
+	free_package(pkg);
+	free_packagedb(packagedb);
+
+	if (failed > 0)
+		exit(1);
+
+	return(0);
+}
+
+
+int pkgrm_help() {
+	printf("usage: pkgrm [options] <package>\n"
+		"options:\n"
+		"  -r, --root <path>           specify alternative installation root\n"
+		"  -F, --fold                  fold the journal into the package database,\n"
+		"                              for tools that only read the database\n"
+		"  -v, --version               print version and exit\n"
+		"  -h, --help                  print help and exit\n");
+	return(0);
+}
@@ -0,0 +1,23 @@
+/*
+	pkgrm.h
+*/
+
+#ifndef _PKGRM_H_
+#define _PKGRM_H_
+
+/*
+	pkgrm_run: handles 'pkgrm' tasks: deletes the files and directories
+		of an installed package that no other package owns, then removes
+		the package from the package database
+*/
+
+int pkgrm_run(int argc, char *argv[]);
+
+
+/*
+	pkgrm_help: prints help/usage for pkgrm
+*/
+
+int pkgrm_help();
+
+#endif
@@ -2,127 +2,254 @@
 	pkgutil.c
 */
 
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <grp.h>
 #include <libgen.h>
 #include <limits.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <regex.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include <archive.h>
 #include <archive_entry.h>
 
+#include "arena.h"
+#include "outbuf.h"
+#include "pkgindex.h"
+#include "pkgjournal.h"
 #include "pkgutil.h"
 
 struct package *create_package(char *name, char *version, int release, char **files, int numfiles) {
 
 	int c;
 
-	struct package *pkg = malloc(sizeof(struct package));
+	// the package and everything it points to live in its own arena
+	struct arena *arena = arena_new();
+	struct package *pkg = arena_alloc(arena, sizeof(struct package));
 
-	pkg->name = strdup(name);
-	pkg->version = strdup(version);
+	pkg->arena = arena;
+	pkg->name = arena_strdup(arena, name);
+	pkg->version = arena_strdup(arena, version);
 	pkg->release = release;
 	pkg->numfiles = numfiles;
 
-	pkg->files = (char **)calloc(numfiles, sizeof(char *));
+	pkg->files = arena_alloc(arena, numfiles * sizeof(char *));
 	for (c = 0; c < numfiles; c++) {
-		pkg->files[c] = strdup(files[c]);
+		pkg->files[c] = arena_strdup(arena, files[c]);
 	}
 
 	return(pkg);
 }
 
 
-struct package *create_package_from_archive(char *filename) {
+int parse_package_filename(char *filename, struct pkgname *pn, char **error) {
 
-	int c;
+	static const char *exts[] = { "gz", "xz", "bz2", "zst" };
+	char *bname, *end, *p;
+	size_t c, len;
+	long release = 0;
 
-	struct package *pkg = malloc(sizeof(struct package));
-	int numfiles = 0;
-	char **pkgfiles;
-	int arrsize = ARRSIZE;
-	pkgfiles = calloc(arrsize, sizeof(char *));
+	bname = (p = strrchr(filename, '/')) != NULL ? p + 1 : filename;
+	len = strlen(bname);
+	memset(pn, 0, sizeof(struct pkgname));
+
+	if (strchr(bname, '#') == NULL) {
+		*error = "missing '#' between name and version";
+		return(-1);
+	}
+
+	// name: [A-Za-z0-9_][A-Za-z0-9_-]* up to the first '#'
+	for (p = bname; *p != '#'; p++) {
+		if (!isalnum((unsigned char)*p) && *p != '_' && (*p != '-' || p == bname)) {
+			*error = p == bname ? "name must start with a letter, digit or '_'" : "invalid character in name";
+			return(-1);
+		}
+	}
+	if (p == bname) {
+		*error = "empty name";
+		return(-1);
+	}
+	pn->name = bname;
+	pn->namelen = p - bname;
+	pn->version = p + 1;
+
+	// extension: the name must end in .pkg.tar.<ext>
+	for (c = 0; c < sizeof(exts) / sizeof(exts[0]); c++) {
+		size_t extlen = strlen(exts[c]);
+		if (len >= extlen + 9 && strcmp(bname + len - extlen, exts[c]) == 0
+				&& memcmp(bname + len - extlen - 9, ".pkg.tar.", 9) == 0) {
+			pn->ext = bname + len - extlen;
+			break;
+		}
+	}
+	if (pn->ext == NULL) {
+		*error = "expected a .pkg.tar.gz, .xz, .bz2 or .zst suffix";
+		return(-1);
+	}
+	end = pn->ext - 9;
+
+	// release: the digits between the last '-' and the suffix
+	for (p = end; p > pn->version && isdigit((unsigned char)p[-1]); p--)
+		;
+	if (p == end || p == pn->version || p[-1] != '-') {
+		*error = "missing '-<release>' before the suffix";
+		return(-1);
+	}
+	for (char *d = p; d < end; d++) {
+		release = release * 10 + (*d - '0');
+		if (release > INT_MAX) {
+			*error = "release number out of range";
+			return(-1);
+		}
+	}
+	pn->release = release;
+
+	// version: everything in between, which must be non-empty and printable
+	pn->versionlen = p - 1 - pn->version;
+	if (pn->versionlen == 0) {
+		*error = "empty version";
+		return(-1);
+	}
+	for (c = 0; c < pn->versionlen; c++) {
+		if (!isgraph((unsigned char)pn->version[c])) {
+			*error = "invalid character in version";
+			return(-1);
+		}
+	}
+
+	return(0);
+}
+
+
+static size_t blocksize = PKGBLOCKSIZE;
+static pthread_once_t blocksize_once = PTHREAD_ONCE_INIT;
+
+
+// reads CPKG_BLOCKSIZE; once, as package files are opened from many threads
+static void init_block_size() {
+
+	char *env;
+	long n;
+
+	if ((env = getenv("CPKG_BLOCKSIZE")) != NULL && (n = atol(env)) >= 512)
+		blocksize = n;
+}
+
+
+size_t package_block_size() {
+
+	pthread_once(&blocksize_once, init_block_size);
+
+	return(blocksize);
+}
+
+
+struct archive *open_package_archive(char *filename, int threads) {
 
 	struct archive *a;
-	struct archive_entry *entry;
-	int r;
+	char value[16];
 
 	a = archive_read_new();
 	archive_read_support_filter_all(a);
 	archive_read_support_format_all(a);
-	r = archive_read_open_filename(a, filename, 10240);
-	if (r != ARCHIVE_OK) {
-		exit(1);
+
+	// let the xz and zstd decoders run on several threads where the
+	// libarchive build supports it; other builds reject the option
+	snprintf(value, sizeof(value), "%d", threads > 0 ? threads : default_jobs());
+	archive_read_set_filter_option(a, "xz", "threads", value);
+	archive_read_set_filter_option(a, "zstd", "threads", value);
+
+	if (archive_read_open_filename(a, filename, package_block_size()) != ARCHIVE_OK) {
+		archive_read_free(a);
+		return(NULL);
 	}
-	while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
+
+	return(a);
+}
+
+
+struct package *read_package_archive(char *filename, int threads, char **error) {
+
+	struct pkgname pn;
+
+	// parse the package name, version, and release from the filename
+	if (parse_package_filename(filename, &pn, error) == -1)
+		return(NULL);
+
+	struct archive *a;
+	struct archive_entry *entry;
+	int r;
+
+	a = open_package_archive(filename, threads);
+	if (a == NULL) {
+		*error = "could not open the package file";
+		return(NULL);
+	}
+
+	struct arena *arena = arena_new();
+	struct package *pkg = arena_alloc(arena, sizeof(struct package));
+	int numfiles = 0;
+	char **pkgfiles;
+	int arrsize = ARRSIZE;
+	pkgfiles = calloc(arrsize, sizeof(char *));
+
+	while ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
 		if (numfiles == arrsize) {
 			arrsize *= 2;
 			pkgfiles = realloc(pkgfiles, arrsize * sizeof(char *));
 		}
-		pkgfiles[numfiles] = strdup(archive_entry_pathname(entry));
+		pkgfiles[numfiles] = arena_strdup(arena, archive_entry_pathname(entry));
 		numfiles++;
 		archive_read_data_skip(a);
 	}
-	r = archive_read_free(a);
-	if (r != ARCHIVE_OK) {
-		exit(1);
-	}
-
-	// parse the package name, version, and release from the filename
-	char *bname;
-	bname = basename(filename);
-	//printf("basename: %s\n", bname);
-	char *pkgname, *pkgver, *pkgrels;
-	int pkgrel;
-
-	int result, nmatch = 4;
-	regex_t cregex;
-	//const char *regex = "^([A-Za-z0-9_-]+)#(.*)-([0-9]+)\\.pkg.*";
-	regmatch_t pmatch[nmatch];
-
-	//printf("regex: %s\n", regex);
-
-	result = regcomp(&cregex, PKGREGEX, REG_EXTENDED);
-	if (result != 0) {
-		printf("error compiling regular expression '%s', aborting\n", PKGREGEX);
-		exit(1);
+	if (archive_read_free(a) != ARCHIVE_OK || r != ARCHIVE_EOF) {
+		*error = "could not read the package file";
+		free(pkgfiles);
+		arena_free(arena);
+		return(NULL);
 	}
 
-	result = regexec(&cregex, bname, nmatch, pmatch, 0);
-
-	c = pmatch[1].rm_eo - pmatch[1].rm_so;
-	pkgname = malloc((c + 1) * sizeof(char));
-	strncpy(pkgname, bname, c);
-	pkgname[c] = '\0';
+	pkg->arena = arena;
+	pkg->name = arena_strndup(arena, pn.name, pn.namelen);
+	pkg->version = arena_strndup(arena, pn.version, pn.versionlen);
+	pkg->release = pn.release;
 
-	c = pmatch[2].rm_eo - pmatch[2].rm_so;
-	pkgver = malloc((c + 1 ) * sizeof(char));
-	strncpy(pkgver, bname + pmatch[2].rm_so, c);
-	pkgver[c] = '\0';
+	// move the file list into the arena as well
+	pkg->numfiles = numfiles;
+	pkg->files = arena_alloc(arena, numfiles * sizeof(char *));
+	memcpy(pkg->files, pkgfiles, numfiles * sizeof(char *));
 
-	c = pmatch[3].rm_eo - pmatch[3].rm_so;
-	pkgrels = malloc((c + 1) * sizeof(char));
-	strncpy(pkgrels, bname + pmatch[3].rm_so, c);
-	pkgrels[c] = '\0';
+	// clean up
+	free(pkgfiles);
 
-	pkgrel = atoi(pkgrels);
+	return(pkg);
+}
 
-	pkg = create_package(pkgname, pkgver, pkgrel, pkgfiles, numfiles);
 
-	// clean up
-	free(pkgname);
-	free(pkgver);
-	free(pkgrels);
+struct package *create_package_from_archive(char *filename) {
 
-	regfree(&cregex);
+	struct package *pkg;
+	char *error;
 
-	for (c = 0; c < numfiles; c++) {
-		free(pkgfiles[c]);
+	if ((pkg = read_package_archive(filename, 0, &error)) == NULL) {
+		printf("pkginfo: '%s': %s\n", filename, error);
+		exit(1);
 	}
-	free(pkgfiles);
 
 	return(pkg);
 }
@@ -130,130 +257,184 @@ struct package *create_package_from_archive(char *filename) {
 
 void free_package(struct package *pkg) {
 
-	int c;
-
-	free(pkg->name);
-	free(pkg->version);
-	for (c = 0; c < pkg->numfiles; c++) {
-		free(pkg->files[c]);
-	}
-	free(pkg->files);
-	free(pkg);
+	// packages read from a package database are freed along with it
+	if (pkg->arena != NULL)
+		arena_free(pkg->arena);
 }
 
 
-struct packagedb *read_packagedb(char *pkgdb) {
+/*
+	read_packagedb_generation: reads the package database generation found
+		at pkgdb and its journal; returns NULL with a static description of
+		the problem in error, or with error left NULL if a newer generation
+		was published while it was read
+*/
 
-	FILE *fp;
+static struct packagedb *read_packagedb_generation(char *pkgdb, char **error) {
 
-	fp = fopen(pkgdb, "r");
-	if (fp == NULL) {
-		printf("Failed to open the package database!\n");
-		exit(EXIT_FAILURE);
+	int fd, c;
+	struct stat st;
+
+	fd = open(pkgdb, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		if (fd != -1)
+			close(fd);
+		*error = "Failed to open the package database!";
+		return(NULL);
+	}
+
+	struct packagedb *packagedb = calloc(1, sizeof(struct packagedb));
+
+	/*
+		map the database privately with one spare zero byte after the end of
+		the file, so every line (including an unterminated last one) can be
+		NUL-terminated in place and used directly as a string
+	*/
+	packagedb->mapsize = st.st_size + 1;
+	packagedb->map = mmap(NULL, packagedb->mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (packagedb->map == MAP_FAILED
+			|| (st.st_size > 0 && mmap(packagedb->map, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+		if (packagedb->map != MAP_FAILED)
+			munmap(packagedb->map, packagedb->mapsize);
+		free(packagedb);
+		close(fd);
+		*error = "Failed to map the package database!";
+		return(NULL);
 	}
+	close(fd);
 
-	// getline(3) setup
-	char *line = NULL;
-	size_t len = 0;
-	ssize_t read;
+	char *map = packagedb->map;
+	char *end = map + st.st_size;
+	char *line, *next;
 
 	// state engine for package database read
 	enum state { PKGNAME, PKGVER, PKGFILES };
-	enum state pkgstate = PKGNAME;
+	enum state pkgstate;
 
-	char *s;
-	char *pkgname, *pkgver;
-	int pkgrel;
-	int x;
+	int numpackages = 0, numfiles = 0;
 
-	int numfiles = 0;
-	char **pkgfiles;
+	// first pass: count packages and files so the arrays are allocated once
+	pkgstate = PKGNAME;
+	for (line = map; line < end; line = next + 1) {
+		if ((next = memchr(line, '\n', end - line)) == NULL)
+			next = end;
 
-	int arrsize = ARRSIZE;
+		switch (pkgstate) {
+			case PKGNAME:
+				pkgstate = PKGVER;
+				break;
+			case PKGVER:
+				pkgstate = PKGFILES;
+				break;
+			case PKGFILES:
+				if (next == line) { // end of package record
+					numpackages++;
+					pkgstate = PKGNAME;
+				} else {
+					numfiles++;
+				}
+				break;
+		}
+	}
+	if (pkgstate != PKGNAME) // last record not followed by a blank line
+		numpackages++;
 
-	struct package *pkg;
-	pkgfiles = calloc(arrsize, sizeof(char *));
+	// the strings stay in the mapping; the records and arrays go in the arena
+	struct arena *arena = packagedb->arena = arena_new();
+	struct package *pkgblock = arena_alloc(arena, numpackages * sizeof(struct package));
+	packagedb->packages = arena_alloc(arena, numpackages * sizeof(struct package *));
 
-	struct package **packages;
-	int dbsize = ARRSIZE;
-	int numpackages = 0;
-	packages = calloc(dbsize, sizeof(struct package *));
+	// second pass: terminate lines in place and point the packages at them
+	struct package *pkg = NULL;
+	char **files = arena_alloc(arena, numfiles * sizeof(char *));
+	char *s;
 
-	// read the package database into memory
-	while ((read = getline(&line, &len, fp)) != -1) {
+	pkgstate = PKGNAME;
+	for (line = map; line < end; line = next + 1) {
+		if ((next = memchr(line, '\n', end - line)) == NULL)
+			next = end;
 
 		// trim the newline character
-		line[strlen(line)-1] = '\0';
+		*next = '\0';
 
 		switch (pkgstate) {
 			case PKGNAME:
-				pkgname = strdup(line);
+				pkg = &pkgblock[packagedb->numpackages];
+				pkg->name = line;
+				pkg->files = files;
+				packagedb->packages[packagedb->numpackages] = pkg;
+				packagedb->numpackages++;
 				pkgstate = PKGVER; // change to next state
 				break;
 			case PKGVER:
-				pkgver = strdup(line);
+				pkg->version = line;
 
 				// split version and release
-				s = strrchr(pkgver, '-');
-				x = (int)(s - pkgver);
-				memmove(s, s + 1, strlen(s));
-				pkgrel = atoi(s);
-				pkgver[x] = '\0';
+				if ((s = strrchr(line, '-')) != NULL) {
+					*s = '\0';
+					pkg->release = atoi(s + 1);
+				}
 				pkgstate = PKGFILES; // change to next state
 				break;
 			case PKGFILES:
-				if (strlen(line) == 0) { // end of package record
-					pkg = create_package(pkgname, pkgver, pkgrel, pkgfiles, numfiles);
-
-					packages[numpackages] = pkg;
-
-					numpackages++;
-					if (numpackages == dbsize) {
-						dbsize *= 2;
-						packages = realloc(packages, dbsize * sizeof(struct package *));
-					}
-
-					free(pkgname);
-					free(pkgver);
-					for (x = 0; x < numfiles; x++) {
-						free(pkgfiles[x]);
-					}
-					free(pkgfiles);
-
-					// reset arrsize and numfiles
-					arrsize = ARRSIZE;
-					numfiles = 0;
-					pkgfiles = calloc(arrsize, sizeof(char *));
-
-					// reset state
+				if (next == line) { // end of package record
 					pkgstate = PKGNAME;
 				} else { // a file owned by this package
-					pkgfiles[numfiles] = strdup(line);
-					numfiles++;
-					if (numfiles == arrsize) { // dynamic array is full, resize it
-						arrsize *= 2;
-						pkgfiles = realloc(pkgfiles, arrsize * sizeof(char *));
-						//printf("realloc: arrsize = %d\n", arrsize);
-					}
+					*files++ = line;
+					pkg->numfiles++;
 				}
 				break;
 		}
 	}
 
+	// a trailing name line without a version is not a package record
+	if (pkgstate == PKGVER)
+		packagedb->numpackages--;
+
+	packagedb->generation = st;
+	if ((c = replay_packagedb_journal(packagedb, pkgdb, &st)) != 0) {
+		if (c == -2)
+			*error = "The package database journal holds changes missing from the package database!";
+		free_packagedb(packagedb);
+		return(NULL);
+	}
+
 #ifdef DEBUG
-	printf("Found %d packages in the package database.\n", numpackages);
+	printf("Found %d packages in the package database.\n", packagedb->numpackages);
+	printf("Package database arena holds %zu bytes.\n", arena_used(arena));
 #endif
 
-	fclose(fp);
-	free(line);
-	free(pkgfiles);
+	return packagedb;
+}
 
-	// marshal the package list and number of packages into a packagedb struct
-	struct packagedb *packagedb = malloc(sizeof(struct packagedb));
-	packagedb->packages = packages;
-	packagedb->numpackages = numpackages;
 
-	return packagedb;
+struct packagedb *load_packagedb(char *pkgdb, char **error) {
+
+	struct packagedb *packagedb;
+
+	// the mapping pins the generation it was read from, since writers only
+	// ever rename new files into place; if the journal turns out to belong
+	// to a newer one, start over
+	do {
+		*error = NULL;
+		packagedb = read_packagedb_generation(pkgdb, error);
+	} while (packagedb == NULL && *error == NULL);
+
+	return(packagedb);
+}
+
+
+struct packagedb *read_packagedb(char *pkgdb) {
+
+	struct packagedb *packagedb;
+	char *error;
+
+	if ((packagedb = load_packagedb(pkgdb, &error)) == NULL) {
+		printf("%s\n", error);
+		exit(EXIT_FAILURE);
+	}
+
+	return(packagedb);
 }
 
 
@@ -261,233 +442,1660 @@ void free_packagedb(struct packagedb *packagedb) {
 
 	int c;
 
+	// packages added after loading own their memory
 	for (c = 0; c < packagedb->numpackages; c++) {
 		free_package(packagedb->packages[c]);
 	}
 
-	free(packagedb->packages);
+	arena_free(packagedb->arena);
+	free(packagedb->hashtable);
+	free(packagedb->owners);
+
+	if (packagedb->map != NULL)
+		munmap(packagedb->map, packagedb->mapsize);
 
 	free(packagedb);
 }
 
 
-int package_in_packagedb(char *pkgname, struct packagedb *packagedb) {
+int write_packagedb(struct packagedb *packagedb, char *pkgdb) {
 
-	int c;
+	int c, fd, r;
+	char tmppath[PATH_MAX + 8];
+	struct outbuf *out;
+	struct fileiter it;
+	struct stat st;
+	const char *path;
+
+	// write to a temporary file and rename it over the old database
+	snprintf(tmppath, sizeof(tmppath), "%s.XXXXXX", pkgdb);
+	if ((fd = mkstemp(tmppath)) == -1)
+		return(-1);
 
+	out = outbuf_new(fd);
 	for (c = 0; c < packagedb->numpackages; c++) {
-		if (strcmp(pkgname, packagedb->packages[c]->name) == 0) {
-			return(c);
+		struct package *pkg = packagedb->packages[c];
+		out_puts(out, pkg->name);
+		out_putc(out, '\n');
+		out_puts(out, pkg->version);
+		out_putc(out, '-');
+		out_putint(out, pkg->release);
+		out_putc(out, '\n');
+		fileiter_init(&it, pkg);
+		while ((path = fileiter_next(&it)) != NULL) {
+			out_puts(out, path);
+			out_putc(out, '\n');
 		}
+		out_putc(out, '\n');
 	}
+	out_flush(out);
+	r = (out->error == 0 && fchmod(fd, 0644) == 0 && fsync(fd) == 0) ? 0 : -1;
+	outbuf_free(out);
+
+	// tell readers that find the new database next to the journal that it
+	// holds the journal's records
+	if (r == 0 && (fstat(fd, &st) == -1 || seal_packagedb_journal(pkgdb, &st) == -1))
+		r = -1;
+
+	if (close(fd) == -1 || r == -1 || rename(tmppath, pkgdb) == -1) {
+		unlink(tmppath);
+		return(-1);
+	}
+	if (sync_parent_dir(pkgdb) == -1)
+		return(-1);
 
-	return(-1);
+	// the database now holds everything the journal recorded; should the
+	// removal be lost in a crash, replaying the journal again is harmless
+	snprintf(tmppath, sizeof(tmppath), "%s%s", pkgdb, PKGJOURNALSUFFIX);
+	unlink(tmppath);
+	packagedb->journalsize = 0;
+
+	return(0);
 }
 
 
-void list_files_in_package(struct package *pkg) {
+unsigned int strhash(const char *s) {
 
-	int c;
+	// 32-bit FNV-1a
+	unsigned int hash = 2166136261U;
 
-	for (c = 0; c < pkg->numfiles; c++) {
-		printf("%s\n", pkg->files[c]);
+	while (*s) {
+		hash ^= (unsigned char)*s++;
+		hash *= 16777619U;
 	}
-}
 
+	return(hash);
+}
 
-void list_file_owners(struct packagedb *packagedb, char *regex) {
 
-	int c, tnc;
-	int width = 7; // width of the package name column ("Package")
+void compact_packagedb(struct packagedb *packagedb) {
 
-	// regex setup stuff
-	int result;
-	regex_t cregex;
-	char lsname[PATH_MAX];
+	struct arena *arena = arena_new();
+	struct package **packages;
+	int c, f;
+#ifdef DEBUG
+	size_t before = arena_used(packagedb->arena) + (packagedb->map ? packagedb->mapsize : 0);
+	size_t fcbytes = 0, plain = 0;
+#endif
 
-	// dynamic array stuff for the matches
-	int arrsize = 32; // start small; often this won't need to expand much
-	int matches = 0;
-	char **owners, **files;
-	owners = calloc(arrsize, sizeof(char *));
-	files = calloc(arrsize, sizeof(char *));
+	if (packagedb->compact)
+		return;
 
-	result = regcomp(&cregex, regex, REG_EXTENDED | REG_NOSUB);
+	packages = arena_alloc(arena, packagedb->numpackages * sizeof(struct package *));
+	struct package *pkgblock = arena_alloc(arena, packagedb->numpackages * sizeof(struct package));
 
-	// loop through files in the package database and check them against the regex
 	for (c = 0; c < packagedb->numpackages; c++) {
-		for (tnc = 0; tnc < packagedb->packages[c]->numfiles; tnc++) {
-			// add a leading '/' to the filename for the regex check
-			snprintf(lsname, strlen(packagedb->packages[c]->files[tnc]) + 2, "/%s", packagedb->packages[c]->files[tnc]);
-			result = regexec(&cregex, lsname, 0, 0, 0);
-			if (!result) {
-				if (matches == arrsize) {
-					arrsize *= 2;
-					owners = realloc(owners, arrsize * sizeof(char *));
-					files = realloc(files, arrsize * sizeof(char *));
-				}
-				owners[matches] = strdup(packagedb->packages[c]->name);
-				files[matches] = strdup(packagedb->packages[c]->files[tnc]);
-				matches++;
-				// adjust package column width if needed
-				if (strlen(packagedb->packages[c]->name) > width) {
-					width = strlen(packagedb->packages[c]->name);
-				}
+		struct package *old = packagedb->packages[c], *pkg = &pkgblock[c];
+
+		pkg->name = arena_strdup(arena, old->name);
+		pkg->version = arena_strdup(arena, old->version);
+		pkg->release = old->release;
+		pkg->numfiles = old->numfiles;
+
+		// an unsorted list can't be front-coded without reordering it
+		if (fclist_sorted(old->files, old->numfiles)) {
+			pkg->fcfiles = fclist_new(arena, old->files, old->numfiles);
+#ifdef DEBUG
+			fcbytes += pkg->fcfiles->size;
+#endif
+		} else {
+			pkg->files = arena_alloc(arena, old->numfiles * sizeof(char *));
+			for (f = 0; f < old->numfiles; f++) {
+				pkg->files[f] = arena_strdup(arena, old->files[f]);
 			}
+#ifdef DEBUG
+			plain++;
+#endif
 		}
-	}
+		packages[c] = pkg;
 
-	if (matches > 0) {
-		printf("%-*s  %s\n", width, "Package", "File");
-		for (c = 0; c < matches; c++) {
-			printf("%-*s  %s\n", width, owners[c], files[c]);
-		}
+		free_package(old);
 	}
 
-	for (c = 0; c < matches; c++) {
-		free(owners[c]);
-		free(files[c]);
+	// drop the old records and everything pointing into them
+	arena_free(packagedb->arena);
+	if (packagedb->map != NULL)
+		munmap(packagedb->map, packagedb->mapsize);
+	free(packagedb->hashtable);
+	free(packagedb->owners);
+
+	packagedb->packages = packages;
+	packagedb->packagessize = packagedb->numpackages;
+	packagedb->arena = arena;
+	packagedb->map = NULL;
+	packagedb->mapsize = 0;
+	packagedb->hashtable = NULL;
+	packagedb->owners = NULL;
+	packagedb->numowners = 0;
+	packagedb->pathtable = NULL;
+	packagedb->compact = 1;
+
+#ifdef DEBUG
+	printf("Compacted the package database from %zu to %zu bytes (%zu of front-coded file lists, %zu packages left unsorted).\n", before, arena_used(arena), fcbytes, plain);
+#endif
+}
+
+
+void fileiter_init(struct fileiter *it, struct package *pkg) {
+
+	it->pkg = pkg;
+	it->index = -1;
+	if (pkg->fcfiles != NULL)
+		fciter_init(&it->fc, pkg->fcfiles);
+}
+
+
+const char *fileiter_next(struct fileiter *it) {
+
+	if (it->pkg->fcfiles != NULL) {
+		const char *path = fciter_next(&it->fc);
+		it->index = it->fc.index;
+		return(path);
 	}
-	free(owners);
-	free(files);
 
-	regfree(&cregex);
+	if (it->index + 1 >= it->pkg->numfiles)
+		return(NULL);
+
+	return(it->pkg->files[++it->index]);
 }
 
 
-void make_footprint(char *filename) {
+void index_packagedb(struct packagedb *packagedb) {
 
 	int c;
+	unsigned int h, mask;
 
-	struct fileinfo {
-		mode_t mode;
-		uid_t uid;
-		gid_t gid;
-		char *filename;
-		int is_hardlink;
-		char *target; // symlink target
-		int is_empty;
-		long unsigned int major, minor;
-	};
-
-	// dynamic array of fileinfo structs for archive metadata
-	struct fileinfo **files;
-	int arrsize = 32, numfiles = 0;
-	files = calloc(arrsize, sizeof(struct fileinfo *));
+	free(packagedb->hashtable);
 
-	// libarchive setup
-	struct archive *a;
-	struct archive_entry *entry;
-	int r;
+	// keep the table at most half full so probe sequences stay short
+	packagedb->hashsize = 16;
+	while (packagedb->hashsize < 2 * (unsigned int)packagedb->numpackages) {
+		packagedb->hashsize *= 2;
+	}
+	mask = packagedb->hashsize - 1;
 
-	a = archive_read_new();
-	archive_read_support_filter_all(a);
-	archive_read_support_format_all(a);
+	packagedb->hashtable = malloc(packagedb->hashsize * sizeof(int));
+	memset(packagedb->hashtable, -1, packagedb->hashsize * sizeof(int));
 
-	r = archive_read_open_filename(a, filename, 10240);
-	if (r != ARCHIVE_OK) {
-		printf("Failed to open archive '%s'.\n", filename);
-		exit(1);
+	for (c = 0; c < packagedb->numpackages; c++) {
+		for (h = strhash(packagedb->packages[c]->name) & mask; packagedb->hashtable[h] != -1; h = (h + 1) & mask) {
+			// keep the first of duplicate names, as the linear scan did
+			if (strcmp(packagedb->packages[packagedb->hashtable[h]]->name, packagedb->packages[c]->name) == 0)
+				break;
+		}
+		if (packagedb->hashtable[h] == -1)
+			packagedb->hashtable[h] = c;
 	}
+}
 
-	while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
 
-		// create a fileinfo entry
-		struct fileinfo *fi = malloc(sizeof(struct fileinfo));
+int package_in_packagedb(char *pkgname, struct packagedb *packagedb) {
 
-		// is the current entry a hardlink?
-		if (archive_entry_hardlink(entry)) {
-			// find the mode of the hardlink's target and use it instead
-			for (c = 0; c < numfiles; c++) {
-				if (strcmp(files[c]->filename, archive_entry_hardlink(entry)) == 0) {
-					//printf("found hardlink target match: %s -> %s\n", archive_entry_pathname(entry), files[c]->filename);
-					fi->mode = files[c]->mode;
-				}
-			}
-			fi->is_hardlink = 1;
-		} else {
-			fi->mode = archive_entry_mode(entry);
-			fi->is_hardlink = 0;
+	int c;
+	unsigned int h, mask;
 
-			// is the current entry an empty file?
-			if (archive_entry_size(entry) == 0)
-				fi->is_empty = 1;
-			else
-				fi->is_empty = 0;
+	// the hash index is built on the first lookup
+	if (packagedb->hashtable == NULL)
+		index_packagedb(packagedb);
 
+	// probe the open-addressing hash index
+	mask = packagedb->hashsize - 1;
+	for (h = strhash(pkgname) & mask; (c = packagedb->hashtable[h]) != -1; h = (h + 1) & mask) {
+		if (strcmp(pkgname, packagedb->packages[c]->name) == 0) {
+			return(c);
 		}
+	}
 
-		fi->uid = archive_entry_uid(entry);
-		fi->gid = archive_entry_gid(entry);
-		fi->filename = strdup(archive_entry_pathname(entry));
+	return(-1);
+}
 
-		// is the current entry a symlink?
-		if (archive_entry_symlink(entry)) {
-			// put its target into the 'target' field
-			fi->target = strdup(archive_entry_symlink(entry));
-		} else {
-			fi->target = NULL;
-		}
 
-		// major/minor values for devices (0 otherwise)
-		fi->major = archive_entry_rdevmajor(entry);
-		fi->minor = archive_entry_rdevminor(entry);
+// drops the indexes of a package database after its packages changed
+void drop_indexes(struct packagedb *packagedb) {
 
-		// put it into the files array
-		if (arrsize == numfiles) {
-			arrsize *= 2;
-			files = realloc(files, arrsize * sizeof(struct fileinfo *));
-		}
-		files[numfiles] = fi;
+	free(packagedb->hashtable);
+	free(packagedb->owners);
+	packagedb->hashtable = NULL;
+	packagedb->owners = NULL;
+	packagedb->numowners = 0;
+	packagedb->pathtable = NULL;
+}
 
-		numfiles++;
 
-		archive_read_data_skip(a);
+void add_package_to_packagedb(struct packagedb *packagedb, struct package *pkg) {
+
+	struct package **packages;
+	int pos;
+
+	// grow the package array in the arena, doubling it each time
+	if (packagedb->numpackages >= packagedb->packagessize) {
+		packagedb->packagessize = packagedb->numpackages < 8 ? 16 : 2 * packagedb->numpackages;
+		packages = arena_alloc(packagedb->arena, packagedb->packagessize * sizeof(struct package *));
+		memcpy(packages, packagedb->packages, packagedb->numpackages * sizeof(struct package *));
+		packagedb->packages = packages;
 	}
 
-	r = archive_read_free(a);
-	if (r != ARCHIVE_OK) {
-		printf("Failed to free archive!\n");
-		exit(1);
+	// keep the database in name order
+	for (pos = packagedb->numpackages; pos > 0 && strcmp(packagedb->packages[pos - 1]->name, pkg->name) > 0; pos--) {
+		packagedb->packages[pos] = packagedb->packages[pos - 1];
 	}
+	packagedb->packages[pos] = pkg;
+	packagedb->numpackages++;
 
-	for (c = 0; c < numfiles; c++) {
-		char *modestr = mtos(files[c]->mode);
+	drop_indexes(packagedb);
+}
 
-		struct passwd *pw = getpwuid(files[c]->uid);
-		struct group *gr = getgrgid(files[c]->gid);
 
-		printf("%s\t%s/%s\t%s", modestr, pw->pw_name, gr->gr_name, files[c]->filename);
+struct package *remove_package_from_packagedb(struct packagedb *packagedb, int index) {
 
-		if (S_ISLNK(files[c]->mode)) {
-			printf(" -> %s", files[c]->target);
-		} else if (S_ISCHR(files[c]->mode) || S_ISBLK(files[c]->mode)) {
-			printf(" (%lu, %lu)", files[c]->major, files[c]->minor);
-		} else if (S_ISREG(files[c]->mode) && files[c]->is_empty == 1) {
-			printf(" (EMPTY)");
-		}
+	struct package *pkg = packagedb->packages[index];
 
-		printf("\n");
+	memmove(&packagedb->packages[index], &packagedb->packages[index + 1], (packagedb->numpackages - index - 1) * sizeof(struct package *));
+	packagedb->numpackages--;
 
-		free(modestr);
-	}
+	drop_indexes(packagedb);
 
-	for (c = 0; c < numfiles; c++) {
-		if (files[c]->target)
-			free(files[c]->target);
-		free(files[c]->filename);
-		free(files[c]);
-	}
-	free(files);
+	return(pkg);
 }
 
 
-char *mtos(mode_t mode) {
+int list_package_in_packagedb(char *pkgdb, char *pkgname, struct outbuf *out) {
 
-	char out[11] = "----------";
-	char *ret;
+	int fd, found = 0;
+	struct stat st;
 
-	// file type
+	fd = open(pkgdb, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		printf("Failed to open the package database!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// the journal has the last word on the packages it mentions
+	struct arena *arena = arena_new();
+	struct hashmap *records;
+	struct package *pkg = NULL;
+	size_t journalsize;
+	int r = read_packagedb_journal(pkgdb, &st, arena, &records, &journalsize);
+	if (r == -1) {
+		// a newer generation was published meanwhile
+		arena_free(arena);
+		close(fd);
+		return(list_package_in_packagedb(pkgdb, pkgname, out));
+	}
+	if (r == -2) {
+		// the database alone would be missing the journal's changes
+		printf("The package database journal holds changes missing from the package database!\n");
+		exit(EXIT_FAILURE);
+	}
+	if (records != NULL) {
+		if ((pkg = hashmap_get(records, pkgname)) != NULL) {
+			found = (pkg->version != NULL);
+			if (found)
+				list_files_in_package(pkg, out);
+		}
+		hashmap_free(records);
+	}
+	arena_free(arena);
+	if (pkg != NULL) {
+		close(fd);
+		return(found ? 0 : -1);
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		return(-1);
+	}
+
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		printf("Failed to map the package database!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	char *end = map + st.st_size;
+	char *line, *next, *files = NULL;
+	size_t namelen = strlen(pkgname);
+
+	// state engine for package database read
+	enum state { PKGNAME, PKGVER, PKGFILES };
+	enum state pkgstate = PKGNAME;
+
+	for (line = map; line < end; line = next + 1) {
+		if ((next = memchr(line, '\n', end - line)) == NULL)
+			next = end;
+
+		switch (pkgstate) {
+			case PKGNAME:
+				found = (next - line == namelen && memcmp(line, pkgname, namelen) == 0);
+				pkgstate = PKGVER; // change to next state
+				break;
+			case PKGVER:
+				files = next + 1;
+				pkgstate = PKGFILES; // change to next state
+				if (!found) {
+					// skip the file block of this record without looking at it
+					if ((next = memmem(next, end - next, "\n\n", 2)) == NULL)
+						next = end;
+					else
+						next++;
+					pkgstate = PKGNAME;
+				}
+				break;
+			case PKGFILES:
+				if (next == line) { // end of the matching package record
+					out_write(out, files, line - files);
+					munmap(map, st.st_size);
+					return(0);
+				}
+				break;
+		}
+	}
+
+	// the matching record is the last one and has no blank line after it
+	if (found && pkgstate == PKGFILES && files < end) {
+		out_write(out, files, end - files);
+		if (end[-1] != '\n')
+			out_putc(out, '\n');
+	}
+
+	munmap(map, st.st_size);
+
+	return(found && pkgstate == PKGFILES ? 0 : -1);
+}
+
+
+void list_files_in_package(struct package *pkg, struct outbuf *out) {
+
+	struct fileiter it;
+	const char *path;
+
+	fileiter_init(&it, pkg);
+	while ((path = fileiter_next(&it)) != NULL) {
+		out_puts(out, path);
+		out_putc(out, '\n');
+	}
+}
+
+
+static int owner_path_cmp(const void *a, const void *b) {
+	return(strcmp(((struct owner *)a)->path, ((struct owner *)b)->path));
+}
+
+
+static int owner_order_cmp(const void *a, const void *b) {
+
+	const struct owner *x = a, *y = b;
+
+	if (x->package != y->package)
+		return(x->package < y->package ? -1 : 1);
+	return(x->file < y->file ? -1 : (x->file > y->file));
+}
+
+
+void index_owners(struct packagedb *packagedb) {
+
+	int c, tnc, n = 0;
+
+	// front-coded paths have no fixed address to sort
+	if (packagedb->owners != NULL || packagedb->compact)
+		return;
+
+	for (c = 0; c < packagedb->numpackages; c++) {
+		n += packagedb->packages[c]->numfiles;
+	}
+
+	packagedb->owners = calloc(n ? n : 1, sizeof(struct owner));
+	packagedb->numowners = n;
+
+	if (packagedb->pathtable != NULL) {
+		// the binary index already holds the files sorted by path
+		for (c = 0; c < n; c++) {
+			packagedb->owners[c].package = packagedb->pathtable[c].package;
+			packagedb->owners[c].file = packagedb->pathtable[c].file;
+			packagedb->owners[c].path = packagedb->packages[packagedb->owners[c].package]->files[packagedb->owners[c].file];
+		}
+		return;
+	}
+
+	n = 0;
+	for (c = 0; c < packagedb->numpackages; c++) {
+		for (tnc = 0; tnc < packagedb->packages[c]->numfiles; tnc++) {
+			packagedb->owners[n].path = packagedb->packages[c]->files[tnc];
+			packagedb->owners[n].package = c;
+			packagedb->owners[n].file = tnc;
+			n++;
+		}
+	}
+
+	qsort(packagedb->owners, n, sizeof(struct owner), owner_path_cmp);
+}
+
+
+int regex_literal_prefix(char *regex, char *prefix, size_t size, int *complete) {
+
+	int c, len = 0, depth = 0;
+	char ch;
+
+	*complete = 0;
+
+	if (regex[0] != '^')
+		return(-1);
+
+	// an alternation outside a bracket expression can drop the anchor
+	for (c = 0; regex[c]; c++) {
+		if (regex[c] == '\\' && regex[c + 1]) {
+			c++;
+		} else if (regex[c] == '[') {
+			// skip the bracket expression; ']' right after '[' or '[^' is literal
+			c++;
+			if (regex[c] == '^')
+				c++;
+			if (regex[c] == ']')
+				c++;
+			while (regex[c] && regex[c] != ']') {
+				if (regex[c] == '[' && (regex[c + 1] == ':' || regex[c + 1] == '.' || regex[c + 1] == '=')) {
+					char *close = strchr(regex + c + 2, regex[c + 1]);
+					if (close == NULL || close[1] != ']')
+						return(-1);
+					c = close - regex + 1;
+				}
+				c++;
+			}
+			if (!regex[c])
+				return(-1);
+		} else if (regex[c] == '(') {
+			depth++;
+		} else if (regex[c] == ')') {
+			depth--;
+		} else if (regex[c] == '|') {
+			return(-1);
+		}
+	}
+	if (depth != 0)
+		return(-1);
+
+	// collect the literal characters following the anchor
+	for (c = 1; regex[c]; ) {
+		if (regex[c] == '\\') {
+			ch = regex[c + 1];
+			// GNU escapes such as \w, \b, \< and back-references are not literals
+			if (ch == '\0' || isalnum((unsigned char)ch) || strchr("<>`'", ch))
+				break;
+			c += 2;
+		} else if (strchr(".[]()*+?{}|^$", regex[c])) {
+			break;
+		} else {
+			ch = regex[c];
+			c++;
+		}
+
+		// a following '*', '?' or '{' makes this character optional
+		if (regex[c] && strchr("*?{", regex[c]))
+			break;
+
+		if (len + 1 >= size)
+			return(-1);
+		prefix[len++] = ch;
+
+		// a following '+' still requires the character once
+		if (regex[c] == '+')
+			break;
+	}
+	prefix[len] = '\0';
+
+	// the whole pattern is the literal, optionally anchored at the end too
+	if (regex[c] == '\0')
+		*complete = 1;
+	else if (regex[c] == '$' && regex[c + 1] == '\0')
+		*complete = 2;
+
+	return(len);
+}
+
+
+// state of the literal factor scan in regex_literals()
+struct factorscan {
+	size_t len, cur;          // end of buf and start of the current factor
+	size_t start[MAXFACTORS]; // collected factors
+	size_t flen[MAXFACTORS];
+	int n;
+	int literal;              // last character went into the current factor
+};
+
+
+static void end_factor(struct literals *lit, struct factorscan *fs) {
+
+	if (fs->len > fs->cur && fs->n < MAXFACTORS) {
+		fs->start[fs->n] = fs->cur;
+		fs->flen[fs->n] = fs->len - fs->cur;
+		lit->buf[fs->len++] = '\0';
+		fs->n++;
+	} else {
+		fs->len = fs->cur;
+	}
+	fs->cur = fs->len;
+	fs->literal = 0;
+}
+
+
+int regex_literals(char *regex, struct literals *lit) {
+
+	int c, depth = 0, i, j, rank;
+	char ch;
+	struct factorscan fs;
+
+	memset(&fs, 0, sizeof(fs));
+	lit->numfactors = 0;
+
+	if (strlen(regex) >= PATH_MAX)
+		return(0);
+
+	for (c = 0; regex[c]; c++) {
+		ch = regex[c];
+
+		if (ch == '[') {
+			// skip the bracket expression; ']' right after '[' or '[^' is literal
+			end_factor(lit, &fs);
+			c++;
+			if (regex[c] == '^')
+				c++;
+			if (regex[c] == ']')
+				c++;
+			while (regex[c] && regex[c] != ']') {
+				if (regex[c] == '[' && (regex[c + 1] == ':' || regex[c + 1] == '.' || regex[c + 1] == '=')) {
+					char *close = strchr(regex + c + 2, regex[c + 1]);
+					if (close == NULL || close[1] != ']')
+						return(0);
+					c = close - regex + 1;
+				}
+				c++;
+			}
+			if (!regex[c])
+				return(0);
+			continue;
+		}
+
+		if (ch == '\\') {
+			ch = regex[++c];
+			if (ch == '\0')
+				return(0);
+			// GNU escapes such as \w, \b, \< and back-references are not literals
+			if (isalnum((unsigned char)ch) || strchr("<>`'", ch)) {
+				end_factor(lit, &fs);
+			} else if (depth == 0) {
+				lit->buf[fs.len++] = ch;
+				fs.literal = 1;
+			}
+			continue;
+		}
+
+		switch (ch) {
+			case '(':
+				end_factor(lit, &fs);
+				depth++;
+				break;
+			case ')':
+				end_factor(lit, &fs);
+				if (depth > 0)
+					depth--;
+				break;
+			case '|':
+				// an alternation at the top level makes nothing required
+				if (depth == 0)
+					return(0);
+				break;
+			case '+':
+				// one occurrence is required, unless another repetition follows
+				if (fs.literal && regex[c + 1] && strchr("*?{", regex[c + 1]))
+					fs.len--;
+				end_factor(lit, &fs);
+				break;
+			case '*':
+			case '?':
+			case '{':
+				// the previous character is optional
+				if (fs.literal)
+					fs.len--;
+				end_factor(lit, &fs);
+				if (ch == '{') {
+					char *close = strchr(regex + c, '}');
+					if (close == NULL)
+						return(0);
+					c = close - regex;
+				}
+				break;
+			case '.':
+			case '^':
+			case '$':
+				end_factor(lit, &fs);
+				break;
+			default:
+				// characters inside groups may be part of an alternative
+				if (depth == 0) {
+					lit->buf[fs.len++] = ch;
+					fs.literal = 1;
+				}
+				break;
+		}
+	}
+	end_factor(lit, &fs);
+
+	// keep the longest factors, which reject the most paths
+	for (i = 0; i < fs.n; i++) {
+		rank = 0;
+		for (j = 0; j < fs.n; j++) {
+			if (fs.flen[j] > fs.flen[i] || (fs.flen[j] == fs.flen[i] && j < i))
+				rank++;
+		}
+		if (rank < MAXLITERALS) {
+			lit->factors[rank] = lit->buf + fs.start[i];
+			lit->lengths[rank] = fs.flen[i];
+		}
+	}
+	lit->numfactors = fs.n < MAXLITERALS ? fs.n : MAXLITERALS;
+
+	return(lit->numfactors);
+}
+
+
+/*
+	find_literal: returns 1 if needle occurs in the n bytes at hay; compares
+		the first and last needle bytes against 16 (or 32) positions at a
+		time and only verifies the candidates, with a scalar tail
+*/
+
+static int find_literal(const char *hay, size_t n, const char *needle, size_t m) {
+
+	size_t i = 0;
+
+	if (m > n)
+		return(0);
+	if (m == 1)
+		return(memchr(hay, needle[0], n) != NULL);
+
+#if defined(__AVX2__)
+	const __m256i first32 = _mm256_set1_epi8(needle[0]);
+	const __m256i last32 = _mm256_set1_epi8(needle[m - 1]);
+
+	for (; i + m + 31 <= n; i += 32) {
+		__m256i f = _mm256_loadu_si256((const __m256i *)(hay + i));
+		__m256i l = _mm256_loadu_si256((const __m256i *)(hay + i + m - 1));
+		unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(f, first32), _mm256_cmpeq_epi8(l, last32)));
+		while (mask) {
+			int bit = __builtin_ctz(mask);
+			if (memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0)
+				return(1);
+			mask &= mask - 1;
+		}
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[m - 1]);
+
+	for (; i + m + 15 <= n; i += 16) {
+		__m128i f = _mm_loadu_si128((const __m128i *)(hay + i));
+		__m128i l = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(f, first), _mm_cmpeq_epi8(l, last)));
+		while (mask) {
+			int bit = __builtin_ctz(mask);
+			if (memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0)
+				return(1);
+			mask &= mask - 1;
+		}
+	}
+#endif
+
+	// scalar search over the remaining start positions
+	for (; i + m <= n; i++) {
+		if (hay[i] == needle[0] && hay[i + m - 1] == needle[m - 1] && memcmp(hay + i + 1, needle + 1, m - 2) == 0)
+			return(1);
+	}
+
+	return(0);
+}
+
+
+int path_has_literals(const char *path, struct literals *lit) {
+
+	int c;
+	size_t n = strlen(path);
+
+	for (c = 0; c < lit->numfactors; c++) {
+		char *factor = lit->factors[c];
+		size_t m = lit->lengths[c];
+
+		// paths are matched with a leading '/', which a factor may start with
+		if (factor[0] == '/' && strncmp(path, factor + 1, m - 1) == 0)
+			continue;
+		if (!find_literal(path, n, factor, m))
+			return(0);
+	}
+
+	return(1);
+}
+
+
+// state of one owner scan worker
+struct ownerscan {
+	struct packagedb *packagedb;
+	char *regex;
+	struct literals *literals; // literals the regex requires
+	int first, last;     // range of packages to scan
+	struct owner *found; // matches, in database order
+	int matches;
+	struct arena *paths; // copies of matching front-coded paths
+	pthread_t thread;
+	int threaded;        // scan runs in its own thread
+};
+
+
+static void *scan_owners(void *arg) {
+
+	struct ownerscan *scan = arg;
+	struct package *pkg;
+	struct fileiter it;
+	const char *path;
+	int c;
+	int arrsize = 32;
+
+	// each worker has its own compiled regex and its own match buffer
+	regex_t cregex;
+	char lsname[PATH_MAX];
+
+	scan->found = calloc(arrsize, sizeof(struct owner));
+	scan->matches = 0;
+
+	if (regcomp(&cregex, scan->regex, REG_EXTENDED | REG_NOSUB) != 0)
+		return(NULL);
+
+	// loop through files in the package range and check them against the regex
+	for (c = scan->first; c < scan->last; c++) {
+		pkg = scan->packagedb->packages[c];
+		fileiter_init(&it, pkg);
+		while ((path = fileiter_next(&it)) != NULL) {
+			// skip paths lacking a literal the regex requires
+			if (!path_has_literals(path, scan->literals))
+				continue;
+
+			// add a leading '/' to the filename for the regex check
+			snprintf(lsname, sizeof(lsname), "/%s", path);
+			if (regexec(&cregex, lsname, 0, 0, 0) == 0) {
+				if (scan->matches == arrsize) {
+					arrsize *= 2;
+					scan->found = realloc(scan->found, arrsize * sizeof(struct owner));
+				}
+				scan->found[scan->matches].path = pkg->fcfiles ? arena_strdup(scan->paths, path) : (char *)path;
+				scan->found[scan->matches].package = c;
+				scan->found[scan->matches].file = it.index;
+				scan->matches++;
+			}
+		}
+	}
+
+	regfree(&cregex);
+
+	return(NULL);
+}
+
+
+/*
+	prefix_match: checks a path that starts with the literal prefix of an
+		anchored pattern against the rest of it; returns 1 on a match, 0 if
+		not, and -1 past the paths an exact pattern can match in sorted order
+*/
+
+static int prefix_match(const char *path, int keylen, int complete, struct literals *literals, regex_t *cregex) {
+
+	char lsname[PATH_MAX];
+
+	if (complete == 2) {
+		// exact path; the range is at most the duplicates of it
+		return(path[keylen] == '\0' ? 1 : -1);
+	} else if (complete == 0) {
+		if (!path_has_literals(path, literals))
+			return(0);
+		snprintf(lsname, sizeof(lsname), "/%s", path);
+		if (regexec(cregex, lsname, 0, 0, 0) != 0)
+			return(0);
+	}
+
+	return(1);
+}
+
+
+// appends a match to a dynamic array of owners
+static void add_owner(struct owner **found, int *matches, int *arrsize, char *path, int package, int file) {
+
+	if (*matches == *arrsize) {
+		*arrsize *= 2;
+		*found = realloc(*found, *arrsize * sizeof(struct owner));
+	}
+	(*found)[*matches].path = path;
+	(*found)[*matches].package = package;
+	(*found)[*matches].file = file;
+	(*matches)++;
+}
+
+
+void list_file_owners(struct packagedb *packagedb, char *regex, int jobs, struct outbuf *out) {
+
+	int c;
+	int width = 7; // width of the package name column ("Package")
+
+	// regex setup stuff
+	int result;
+	regex_t cregex;
+	char prefix[PATH_MAX];
+	int prefixlen, complete;
+	struct literals literals;
+
+	// copies of matching front-coded paths, and the scan workers holding more
+	struct arena *paths = NULL;
+	struct ownerscan *scans = NULL;
+	int numscans = 0;
+
+	// dynamic array stuff for the matches
+	int arrsize = 32; // start small; often this won't need to expand much
+	int matches = 0;
+	struct owner *found;
+	found = calloc(arrsize, sizeof(struct owner));
+
+	result = regcomp(&cregex, regex, REG_EXTENDED | REG_NOSUB);
+	if (result != 0) {
+		out_puts(out, "pkginfo: invalid regular expression '");
+		out_puts(out, regex);
+		out_puts(out, "'\n");
+		free(found);
+		return;
+	}
+
+	prefixlen = regex_literal_prefix(regex, prefix, sizeof(prefix), &complete);
+	regex_literals(regex, &literals);
+
+	if (prefixlen > 0) {
+		// anchored literal prefix: every match sits in one range of the sorted
+		// owner index, and paths are matched with a leading '/'
+		if (prefix[0] == '/' && packagedb->compact) {
+			// front-coded file lists are sorted, so seek each one to the key;
+			// the matches come out in package database order
+			char *key = prefix + 1;
+			int keylen = prefixlen - 1, tnc, r;
+			struct fciter it;
+			const char *path;
+
+			paths = arena_new();
+			for (c = 0; c < packagedb->numpackages; c++) {
+				struct package *pkg = packagedb->packages[c];
+				if (pkg->fcfiles == NULL) {
+					// an unsorted list kept as it was
+					for (tnc = 0; tnc < pkg->numfiles; tnc++) {
+						if (strncmp(pkg->files[tnc], key, keylen) == 0 && prefix_match(pkg->files[tnc], keylen, complete, &literals, &cregex) > 0)
+							add_owner(&found, &matches, &arrsize, pkg->files[tnc], c, tnc);
+					}
+					continue;
+				}
+				for (path = fciter_seek(&it, pkg->fcfiles, key); path != NULL && strncmp(path, key, keylen) == 0; path = fciter_next(&it)) {
+					if ((r = prefix_match(path, keylen, complete, &literals, &cregex)) < 0)
+						break;
+					if (r > 0)
+						add_owner(&found, &matches, &arrsize, arena_strdup(paths, path), c, it.index);
+				}
+			}
+		} else if (prefix[0] == '/') {
+			int lo = 0, hi, mid, r;
+			char *key = prefix + 1;
+			int keylen = prefixlen - 1;
+
+			index_owners(packagedb);
+
+			// binary search for the first path not below the key
+			hi = packagedb->numowners;
+			while (lo < hi) {
+				mid = lo + (hi - lo) / 2;
+				if (strcmp(packagedb->owners[mid].path, key) < 0)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+
+			for (c = lo; c < packagedb->numowners && strncmp(packagedb->owners[c].path, key, keylen) == 0; c++) {
+				struct owner *o = &packagedb->owners[c];
+				if ((r = prefix_match(o->path, keylen, complete, &literals, &cregex)) < 0)
+					break;
+				if (r > 0)
+					add_owner(&found, &matches, &arrsize, o->path, o->package, o->file);
+			}
+
+			// report the matches in package database order
+			qsort(found, matches, sizeof(struct owner), owner_order_cmp);
+		}
+	} else {
+		// full scan, split across worker threads in database order
+		int total = 0, w, first, files;
+
+		for (c = 0; c < packagedb->numpackages; c++) {
+			total += packagedb->packages[c]->numfiles;
+		}
+
+		// don't start threads that would have too little to do
+		if (jobs <= 0)
+			jobs = default_jobs();
+		if (jobs > total / OWNERSCANMIN)
+			jobs = total / OWNERSCANMIN;
+		if (jobs < 1)
+			jobs = 1;
+
+		scans = calloc(jobs, sizeof(struct ownerscan));
+		numscans = jobs;
+
+		// give each worker a contiguous range with about the same number of files
+		for (w = 0, c = 0; w < jobs; w++) {
+			first = c;
+			files = 0;
+			while (c < packagedb->numpackages && (w == jobs - 1 || files < total / jobs)) {
+				files += packagedb->packages[c]->numfiles;
+				c++;
+			}
+			scans[w].packagedb = packagedb;
+			scans[w].regex = regex;
+			scans[w].literals = &literals;
+			scans[w].first = first;
+			scans[w].last = c;
+			if (packagedb->compact)
+				scans[w].paths = arena_new();
+		}
+
+		for (w = 1; w < jobs; w++) {
+			scans[w].threaded = (pthread_create(&scans[w].thread, NULL, scan_owners, &scans[w]) == 0);
+		}
+		scan_owners(&scans[0]);
+
+		// concatenate the per-worker matches, which keeps database order
+		for (w = 0; w < jobs; w++) {
+			if (scans[w].threaded)
+				pthread_join(scans[w].thread, NULL);
+			else if (w > 0) // no thread available, scan the range here instead
+				scan_owners(&scans[w]);
+			if (matches + scans[w].matches > arrsize) {
+				arrsize = matches + scans[w].matches;
+				found = realloc(found, arrsize * sizeof(struct owner));
+			}
+			memcpy(found + matches, scans[w].found, scans[w].matches * sizeof(struct owner));
+			matches += scans[w].matches;
+			free(scans[w].found);
+		}
+	}
+
+	// adjust package column width if needed
+	for (c = 0; c < matches; c++) {
+		if (strlen(packagedb->packages[found[c].package]->name) > width) {
+			width = strlen(packagedb->packages[found[c].package]->name);
+		}
+	}
+
+	if (matches > 0) {
+		out_pad(out, "Package", width);
+		out_puts(out, "  File\n");
+		for (c = 0; c < matches; c++) {
+			out_pad(out, packagedb->packages[found[c].package]->name, width);
+			out_write(out, "  ", 2);
+			out_puts(out, found[c].path);
+			out_putc(out, '\n');
+		}
+	}
+
+	free(found);
+	for (c = 0; c < numscans; c++) {
+		if (scans[c].paths != NULL)
+			arena_free(scans[c].paths);
+	}
+	free(scans);
+	if (paths != NULL)
+		arena_free(paths);
+
+	regfree(&cregex);
+}
+
+
+// user or group name cached by id
+struct idname {
+	unsigned int id;
+	char *name;
+};
+
+// per-run cache of user and group names for footprints
+struct idcache {
+	struct idname *users, *groups;
+	int numusers, numgroups;
+};
+
+
+/*
+	lookup_id: returns the user (or group) name of id from the cache,
+		asking NSS only on the first use of an id; ids without a name are
+		shown as numbers
+*/
+
+static char *lookup_id(struct idname **names, int *num, unsigned int id, int group) {
+
+	int c, r;
+	char name[16], *buf;
+	char *found = NULL;
+	long bufsize;
+
+	for (c = 0; c < *num; c++) {
+		if ((*names)[c].id == id)
+			return((*names)[c].name);
+	}
+
+	// large groups don't fit the suggested size; grow the buffer until
+	// the entry does, as getgrgid(3) would
+	if ((bufsize = sysconf(group ? _SC_GETGR_R_SIZE_MAX : _SC_GETPW_R_SIZE_MAX)) <= 0)
+		bufsize = 16384;
+	buf = malloc(bufsize);
+
+	for (;;) {
+		if (group) {
+			struct group gr, *grp = NULL;
+			if ((r = getgrgid_r(id, &gr, buf, bufsize, &grp)) == 0 && grp != NULL)
+				found = grp->gr_name;
+		} else {
+			struct passwd pw, *pwp = NULL;
+			if ((r = getpwuid_r(id, &pw, buf, bufsize, &pwp)) == 0 && pwp != NULL)
+				found = pwp->pw_name;
+		}
+		if (r != ERANGE)
+			break;
+		bufsize *= 2;
+		buf = realloc(buf, bufsize);
+	}
+
+	if (found == NULL) {
+		snprintf(name, sizeof(name), "%u", id);
+		found = name;
+	}
+
+	*names = realloc(*names, (*num + 1) * sizeof(struct idname));
+	(*names)[*num].id = id;
+	(*names)[*num].name = strdup(found);
+	free(buf);
+
+	return((*names)[(*num)++].name);
+}
+
+
+static void free_idcache(struct idcache *cache) {
+
+	int c;
+
+	for (c = 0; c < cache->numusers; c++) {
+		free(cache->users[c].name);
+	}
+	for (c = 0; c < cache->numgroups; c++) {
+		free(cache->groups[c].name);
+	}
+	free(cache->users);
+	free(cache->groups);
+}
+
+
+// mode of a footprinted entry, kept by path for later hardlinks
+struct linkmode {
+	uint64_t hash; // 0 marks an empty slot
+	char *path;    // in the arena of the linkmodes
+	mode_t mode;
+};
+
+// hardlink target modes of a streaming footprint
+struct linkmodes {
+	struct linkmode *entries;
+	size_t size, count;
+	struct arena *paths;
+};
+
+
+// 64-bit FNV-1a hash of a path, never 0
+static uint64_t pathhash64(const char *s) {
+
+	uint64_t hash = 14695981039346656037ULL;
+
+	while (*s) {
+		hash ^= (unsigned char)*s++;
+		hash *= 1099511628211ULL;
+	}
+
+	return(hash ? hash : 1);
+}
+
+
+// returns the slot of path, or the empty slot where it would go; the hash
+// only picks the slot, the path itself has to match too
+static struct linkmode *linkmode_find(struct linkmode *entries, size_t size, uint64_t hash, const char *path) {
+
+	size_t h, mask = size - 1;
+
+	for (h = hash & mask; entries[h].hash != 0; h = (h + 1) & mask) {
+		if (entries[h].hash == hash && strcmp(entries[h].path, path) == 0)
+			break;
+	}
+
+	return(&entries[h]);
+}
+
+
+static void linkmode_put(struct linkmodes *lm, const char *path, mode_t mode) {
+
+	size_t c;
+	uint64_t hash = pathhash64(path);
+	struct linkmode *e;
+
+	if (lm->paths == NULL)
+		lm->paths = arena_new();
+
+	if (2 * (lm->count + 1) > lm->size) {
+		size_t size = lm->size ? lm->size * 2 : 1024;
+		struct linkmode *entries = calloc(size, sizeof(struct linkmode));
+		for (c = 0; c < lm->size; c++) {
+			if (lm->entries[c].hash != 0)
+				*linkmode_find(entries, size, lm->entries[c].hash, lm->entries[c].path) = lm->entries[c];
+		}
+		free(lm->entries);
+		lm->entries = entries;
+		lm->size = size;
+	}
+
+	e = linkmode_find(lm->entries, lm->size, hash, path);
+	if (e->hash == 0) {
+		e->hash = hash;
+		e->path = arena_strdup(lm->paths, path);
+		lm->count++;
+	}
+	e->mode = mode;
+}
+
+
+static int linkmode_get(struct linkmodes *lm, const char *path, mode_t *mode) {
+
+	struct linkmode *e;
+
+	if (lm->size == 0)
+		return(0);
+
+	e = linkmode_find(lm->entries, lm->size, pathhash64(path), path);
+	if (e->hash == 0)
+		return(0);
+
+	*mode = e->mode;
+	return(1);
+}
+
+
+// sort key of a footprint line: everything after the second tab, like 'sort -k 3'
+static char *footprint_key(char *line) {
+
+	char *key = strchr(line, '\t');
+
+	if (key != NULL && (key = strchr(key + 1, '\t')) != NULL)
+		return(key + 1);
+
+	return(line);
+}
+
+
+// footprint line with its sort key
+struct footline {
+	char *line, *key;
+};
+
+
+static int footline_cmp(const void *a, const void *b) {
+
+	const struct footline *x = a, *y = b;
+	int r = strcmp(x->key, y->key);
+
+	return(r != 0 ? r : strcmp(x->line, y->line));
+}
+
+
+// lines of a sorted footprint; sorted runs are spilled to temporary files
+struct footsort {
+	struct outbuf *run;  // NUL-terminated lines of the current run
+	size_t *lines;       // offsets of those lines
+	size_t numlines, arrsize;
+	FILE **runs;         // spilled runs, one line per text line
+	int numruns;
+};
+
+
+// sorts the current run and writes it to out, or spills it to a temporary
+// file; returns 0, or -1 if the run could not be spilled
+static int footsort_flush(struct footsort *fs, struct outbuf *out) {
+
+	size_t c;
+	struct footline *sorted = malloc((fs->numlines ? fs->numlines : 1) * sizeof(struct footline));
+
+	for (c = 0; c < fs->numlines; c++) {
+		sorted[c].line = fs->run->buf + fs->lines[c];
+		sorted[c].key = footprint_key(sorted[c].line);
+	}
+	qsort(sorted, fs->numlines, sizeof(struct footline), footline_cmp);
+
+	if (out != NULL) {
+		for (c = 0; c < fs->numlines; c++) {
+			out_puts(out, sorted[c].line);
+			out_putc(out, '\n');
+		}
+	} else {
+		FILE *fp = tmpfile();
+		if (fp == NULL) {
+			free(sorted);
+			return(-1);
+		}
+		for (c = 0; c < fs->numlines; c++) {
+			fputs(sorted[c].line, fp);
+			fputc('\n', fp);
+		}
+		rewind(fp);
+		fs->runs = realloc(fs->runs, (fs->numruns + 1) * sizeof(FILE *));
+		fs->runs[fs->numruns++] = fp;
+	}
+
+	free(sorted);
+	fs->run->len = 0;
+	fs->numlines = 0;
+
+	return(0);
+}
+
+
+// records where the next line of the current run starts; the caller
+// spills the run with footsort_flush once it is full
+static void footsort_add(struct footsort *fs) {
+
+	if (fs->numlines == fs->arrsize) {
+		fs->arrsize = fs->arrsize ? fs->arrsize * 2 : 1024;
+		fs->lines = realloc(fs->lines, fs->arrsize * sizeof(size_t));
+	}
+	fs->lines[fs->numlines++] = fs->run->len;
+}
+
+
+// merges the spilled runs into out
+static void footsort_merge(struct footsort *fs, struct outbuf *out) {
+
+	int c, min;
+	char **lines = calloc(fs->numruns, sizeof(char *));
+	size_t *sizes = calloc(fs->numruns, sizeof(size_t));
+	ssize_t len;
+	struct footline x, y;
+
+	for (c = 0; c < fs->numruns; c++) {
+		if ((len = getline(&lines[c], &sizes[c], fs->runs[c])) == -1) {
+			free(lines[c]);
+			lines[c] = NULL;
+		} else {
+			lines[c][len - 1] = '\0';
+		}
+	}
+
+	for (;;) {
+		// the run holding the smallest line; runs are few, so look at all
+		min = -1;
+		for (c = 0; c < fs->numruns; c++) {
+			if (lines[c] == NULL)
+				continue;
+			if (min != -1) {
+				x.line = lines[c];
+				x.key = footprint_key(x.line);
+				y.line = lines[min];
+				y.key = footprint_key(y.line);
+			}
+			if (min == -1 || footline_cmp(&x, &y) < 0)
+				min = c;
+		}
+		if (min == -1)
+			break;
+
+		out_puts(out, lines[min]);
+		out_putc(out, '\n');
+
+		if ((len = getline(&lines[min], &sizes[min], fs->runs[min])) == -1) {
+			free(lines[min]);
+			lines[min] = NULL;
+		} else {
+			lines[min][len - 1] = '\0';
+		}
+	}
+
+	for (c = 0; c < fs->numruns; c++) {
+		fclose(fs->runs[c]);
+	}
+	free(lines);
+	free(sizes);
+}
+
+
+int make_footprint(char *filename, struct outbuf *out, int sort, int threads) {
+
+	char modestr[11];
+	char *user, *group;
+	mode_t mode;
+	const char *path;
+	int c, failed = 0;
+
+	// libarchive setup
+	struct archive *a;
+	struct archive_entry *entry;
+	int r;
+
+	a = open_package_archive(filename, threads);
+	if (a == NULL) {
+		return(-1);
+	}
+
+	// modes of the entries seen so far, for resolving hardlinks
+	struct linkmodes links;
+	memset(&links, 0, sizeof(links));
+
+	// user and group names, looked up once per id
+	struct idcache ids;
+	memset(&ids, 0, sizeof(ids));
+
+	// sorted output goes through bounded runs instead of straight to out
+	struct footsort fs;
+	memset(&fs, 0, sizeof(fs));
+	struct outbuf *dest = out;
+	if (sort) {
+		fs.run = outbuf_new(-1);
+		dest = fs.run;
+	}
+
+	while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
+
+		path = archive_entry_pathname(entry);
+
+		// is the current entry a hardlink?
+		if (archive_entry_hardlink(entry)) {
+			// use the mode of the hardlink's target instead
+			if (!linkmode_get(&links, archive_entry_hardlink(entry), &mode))
+				mode = archive_entry_mode(entry);
+		} else {
+			mode = archive_entry_mode(entry);
+		}
+
+		// directories can't be hardlink targets, everything else is remembered
+		if (!S_ISDIR(mode))
+			linkmode_put(&links, path, mode);
+
+		format_mode(mode, modestr);
+		user = lookup_id(&ids.users, &ids.numusers, archive_entry_uid(entry), 0);
+		group = lookup_id(&ids.groups, &ids.numgroups, archive_entry_gid(entry), 1);
+
+		if (sort)
+			footsort_add(&fs);
+
+		out_puts(dest, modestr);
+		out_putc(dest, '\t');
+		out_puts(dest, user);
+		out_putc(dest, '/');
+		out_puts(dest, group);
+		out_putc(dest, '\t');
+		out_puts(dest, path);
+
+		if (S_ISLNK(mode)) {
+			out_puts(dest, " -> ");
+			out_puts(dest, archive_entry_symlink(entry) ? archive_entry_symlink(entry) : "(null)");
+		} else if (S_ISCHR(mode) || S_ISBLK(mode)) {
+			out_puts(dest, " (");
+			out_putint(dest, archive_entry_rdevmajor(entry));
+			out_puts(dest, ", ");
+			out_putint(dest, archive_entry_rdevminor(entry));
+			out_putc(dest, ')');
+		} else if (S_ISREG(mode) && !archive_entry_hardlink(entry) && archive_entry_size(entry) == 0) {
+			out_puts(dest, " (EMPTY)");
+		}
+
+		if (sort) {
+			out_putc(dest, '\0');
+			if (fs.run->len >= FOOTPRINTRUN && footsort_flush(&fs, NULL) == -1) {
+				failed = 1;
+				break;
+			}
+		} else {
+			out_putc(dest, '\n');
+		}
+
+		archive_read_data_skip(a);
+	}
+
+	// this runs in the worker threads of make_footprints, so failures are
+	// returned rather than ending the process
+	r = archive_read_free(a);
+	if (r != ARCHIVE_OK)
+		failed = 1;
+
+	if (sort) {
+		if (failed) {
+			for (c = 0; c < fs.numruns; c++) {
+				fclose(fs.runs[c]);
+			}
+		} else if (fs.numruns == 0) {
+			// everything fit in one run
+			footsort_flush(&fs, out);
+		} else if (footsort_flush(&fs, NULL) == 0) {
+			footsort_merge(&fs, out);
+		} else {
+			for (c = 0; c < fs.numruns; c++) {
+				fclose(fs.runs[c]);
+			}
+			failed = 1;
+		}
+		outbuf_free(fs.run);
+		free(fs.lines);
+		free(fs.runs);
+	}
+
+	free(links.entries);
+	if (links.paths != NULL)
+		arena_free(links.paths);
+	free_idcache(&ids);
+
+	return(failed ? -2 : 0);
+}
+
+
+// shared state of a batch of footprints
+struct footbatch {
+	char **filenames;
+	char *outdir;
+	int sort;
+	int count;
+	int threads;             // decoder threads per archive
+	int headers;             // precede each footprint with its file name
+	struct outbuf **results; // finished footprints waiting for their turn
+	int *done;               // 1 when finished, -1 when failed
+	int next;                // next footprint to write to out
+	int window;              // how far past next a worker may start
+	int failed;
+	struct outbuf *out;
+	pthread_mutex_t lock;
+	pthread_cond_t advanced; // signalled when next moves on
+};
+
+
+// message for a failed footprint; -1 means the archive didn't open
+static void footprint_error(struct outbuf *out, char *filename, int r) {
+	out_puts(out, r == -1 ? "Failed to open archive '" : "Failed to read archive '");
+	out_puts(out, filename);
+	out_puts(out, "'.\n");
+}
+
+
+static void footprint_worker(void *arg, int item) {
+
+	struct footbatch *fb = arg;
+	struct outbuf *buf;
+	char path[PATH_MAX];
+	int fd = -1, r;
+
+	if (fb->outdir != NULL) {
+		// write straight to <outdir>/<archive>.footprint
+		char *name = strrchr(fb->filenames[item], '/');
+		name = name ? name + 1 : fb->filenames[item];
+		snprintf(path, sizeof(path), "%s/%s.footprint", fb->outdir, name);
+		if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+			pthread_mutex_lock(&fb->lock);
+			printf("pkginfo: could not create '%s'\n", path);
+			fb->failed++;
+			pthread_mutex_unlock(&fb->lock);
+			return;
+		}
+	}
+
+	// finished footprints wait in memory for the ones before them, so
+	// don't run too far ahead of the output
+	if (fd == -1) {
+		pthread_mutex_lock(&fb->lock);
+		while (item - fb->next >= fb->window)
+			pthread_cond_wait(&fb->advanced, &fb->lock);
+		pthread_mutex_unlock(&fb->lock);
+	}
+
+	buf = outbuf_new(fd);
+	if (fb->headers) {
+		out_puts(buf, "==> ");
+		out_puts(buf, fb->filenames[item]);
+		out_puts(buf, " <==\n");
+	}
+	size_t mark = buf->len;
+
+	if ((r = make_footprint(fb->filenames[item], buf, fb->sort, fb->threads)) < 0) {
+		// report the failure in place of the footprint
+		buf->len = mark;
+		footprint_error(buf, fb->filenames[item], r);
+	}
+
+	if (fd != -1) {
+		outbuf_free(buf);
+		close(fd);
+		if (r < 0) {
+			unlink(path);
+			pthread_mutex_lock(&fb->lock);
+			footprint_error(fb->out, fb->filenames[item], r);
+			fb->failed++;
+			pthread_mutex_unlock(&fb->lock);
+		}
+		return;
+	}
+
+	// emit every finished footprint that is next in input order
+	pthread_mutex_lock(&fb->lock);
+	fb->results[item] = buf;
+	fb->done[item] = (r == 0) ? 1 : -1;
+	while (fb->next < fb->count && fb->done[fb->next] != 0) {
+		struct outbuf *res = fb->results[fb->next];
+		if (fb->done[fb->next] == -1)
+			fb->failed++;
+		if (fb->headers && fb->next > 0)
+			out_putc(fb->out, '\n');
+		out_write(fb->out, res->buf, res->len);
+		outbuf_free(res);
+		fb->results[fb->next] = NULL;
+		fb->next++;
+	}
+	pthread_cond_broadcast(&fb->advanced);
+	pthread_mutex_unlock(&fb->lock);
+}
+
+
+// orders package file paths by their basenames
+static int archive_name_cmp(const void *a, const void *b) {
+
+	const char *x = *(char **)a, *y = *(char **)b;
+	const char *s = strrchr(x, '/'), *t = strrchr(y, '/');
+
+	return(strcmp(s ? s + 1 : x, t ? t + 1 : y));
+}
+
+
+int make_footprints(char **filenames, int count, char *outdir, int sort, int jobs, struct outbuf *out) {
+
+	struct footbatch fb;
+	int c, same = 0;
+
+	// a footprint in outdir is named after its archive alone, so archives
+	// of the same name in different directories would overwrite each other
+	if (outdir != NULL) {
+		char **names = malloc(count * sizeof(char *));
+		memcpy(names, filenames, count * sizeof(char *));
+		qsort(names, count, sizeof(char *), archive_name_cmp);
+		for (c = 1; c < count; c++) {
+			if (archive_name_cmp(&names[c - 1], &names[c]) == 0) {
+				char *name = strrchr(names[c], '/');
+				printf("pkginfo: '%s' and '%s' would both be written to '%s/%s.footprint'\n",
+					names[c - 1], names[c], outdir, name ? name + 1 : names[c]);
+				same++;
+			}
+		}
+		free(names);
+		if (same > 0)
+			return(count);
+	}
+
+	memset(&fb, 0, sizeof(fb));
+	fb.filenames = filenames;
+	fb.outdir = outdir;
+	fb.sort = sort;
+	fb.count = count;
+	// the workers already keep the CPUs busy; only a lone archive gets
+	// multithreaded decoding
+	fb.threads = (count == 1) ? 0 : 1;
+	fb.headers = (outdir == NULL && count > 1);
+	fb.results = calloc(count + 1, sizeof(struct outbuf *));
+	fb.done = calloc(count + 1, sizeof(int));
+	fb.out = out;
+	fb.window = 2 * (jobs > 0 ? jobs : default_jobs());
+	pthread_mutex_init(&fb.lock, NULL);
+	pthread_cond_init(&fb.advanced, NULL);
+
+	run_parallel(jobs, count, footprint_worker, &fb);
+
+	pthread_cond_destroy(&fb.advanced);
+	pthread_mutex_destroy(&fb.lock);
+	free(fb.results);
+	free(fb.done);
+
+	return(fb.failed);
+}
+
+
+void format_mode(mode_t mode, char *out) {
+
+	strcpy(out, "----------");
+
+	// file type
 	switch (mode & S_IFMT) {
 		case S_IFREG:  out[0] = '-'; break; // regular file
 		case S_IFDIR:  out[0] = 'd'; break; // directory
@@ -528,10 +2136,106 @@ char *mtos(mode_t mode) {
 		case S_IXOTH | S_ISVTX: out[9] = 't'; break;
 		default:                out[9] = '-'; break;
 	}
+}
+
+
+char *mtos(mode_t mode) {
+
+	char out[11];
+
+	format_mode(mode, out);
+
+	return(strdup(out));
+}
+
+
+// shared state of run_parallel()
+struct parallel {
+	void (*func)(void *arg, int item);
+	void *arg;
+	int count;
+	int next; // next item to hand out
+	pthread_mutex_t lock;
+};
+
+
+static void *parallel_worker(void *arg) {
+
+	struct parallel *p = arg;
+	int item;
+
+	for (;;) {
+		pthread_mutex_lock(&p->lock);
+		item = p->next < p->count ? p->next++ : -1;
+		pthread_mutex_unlock(&p->lock);
+
+		if (item == -1)
+			break;
+		p->func(p->arg, item);
+	}
+
+	return(NULL);
+}
+
+
+void run_parallel(int jobs, int count, void (*func)(void *arg, int item), void *arg) {
+
+	int c;
+	struct parallel p;
+	pthread_t *threads;
+	int *started;
+
+	if (jobs <= 0)
+		jobs = default_jobs();
+	if (jobs > count)
+		jobs = count;
+
+	p.func = func;
+	p.arg = arg;
+	p.count = count;
+	p.next = 0;
+	pthread_mutex_init(&p.lock, NULL);
+
+	threads = calloc(jobs + 1, sizeof(pthread_t));
+	started = calloc(jobs + 1, sizeof(int));
+
+	// the calling thread is one of the workers
+	for (c = 1; c < jobs; c++) {
+		started[c] = (pthread_create(&threads[c], NULL, parallel_worker, &p) == 0);
+	}
+	parallel_worker(&p);
+
+	for (c = 1; c < jobs; c++) {
+		if (started[c])
+			pthread_join(threads[c], NULL);
+	}
+
+	pthread_mutex_destroy(&p.lock);
+	free(threads);
+	free(started);
+}
+
+
+int default_jobs() {
+
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return(n > 0 ? n : 1);
+}
+
+
+int sync_parent_dir(char *path) {
+
+	char dir[PATH_MAX];
+	int fd, r;
 
-	ret = strdup(out);
+	snprintf(dir, sizeof(dir), "%s", path);
+	if ((fd = open(dirname(dir), O_RDONLY | O_DIRECTORY)) == -1)
+		return(-1);
+	r = fsync(fd);
+	close(fd);
 
-	return(ret);
+	return(r);
 }
 
 
@@ -5,14 +5,36 @@
 #ifndef _PKGUTIL_H_
 #define _PKGUTIL_H_
 
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "frontcode.h"
+
 // package database location
 #define PKGDB "/var/lib/pkg/db"
 
 // starting size for dynamic arrays
 #define ARRSIZE 256
 
-// basic package file regex
-#define PKGREGEX "^([A-Za-z0-9_][A-Za-z0-9_-]*)#(.+)-([0-9]+)\\.pkg\\.tar\\.[gxb]z2?"
+// minimum number of files per worker thread in a full owner scan
+#define OWNERSCANMIN 4096
+
+// literal factors collected from an owner regex, and the number kept
+#define MAXFACTORS 16
+#define MAXLITERALS 4
+
+// size of the in-memory runs of a sorted footprint
+#define FOOTPRINTRUN (16 * 1024 * 1024)
+
+// package file name grammar, as accepted by parse_package_filename
+#define PKGREGEX "^([A-Za-z0-9_][A-Za-z0-9_-]*)#(.+)-([0-9]+)\\.pkg\\.tar\\.(gz|xz|bz2|zst)"
+
+// default block size for reading package files; CPKG_BLOCKSIZE overrides it
+#define PKGBLOCKSIZE 131072
+
+struct archive;
+struct arena;
+struct outbuf;
 
 // package information structure
 struct package {
@@ -20,33 +42,115 @@ struct package {
 	int release;          // package release/revision number
 	char **files;         // list of files owned by the package (dynamic array)
 	int numfiles;         // number of files owned by the package
+	struct arena *arena;  // memory of the package, NULL if a packagedb owns it
+	struct fclist *fcfiles; // front-coded file list used instead of files
+};
+
+// iterates over the files of a package, whichever way they are stored
+struct fileiter {
+	struct package *pkg;
+	int index;            // index of the current file
+	struct fciter fc;
+};
+
+// views into a package file name; the strings are not NUL-terminated
+struct pkgname {
+	char *name, *version, *ext;
+	size_t namelen, versionlen;
+	int release;
+};
+
+// owner index entry: a file path and the package it belongs to
+struct owner {
+	char *path;
+	int package, file; // indexes in the packages array and the file list
+};
+
+// literal strings every match of a regex has to contain
+struct literals {
+	char *factors[MAXLITERALS]; // longest first
+	size_t lengths[MAXLITERALS];
+	int numfactors;
+	char buf[2 * PATH_MAX];
 };
 
 // package database structure, holds a dynamic array of struct package pointers
 struct packagedb {
 	struct package **packages;
 	int numpackages;
+	int packagessize;         // slots in packages once it has been grown
+	struct arena *arena;      // package records and file lists read from disk
+	char *map;                // private mapping of the on-disk database; all
+	size_t mapsize;           // package strings point into it
+	int *hashtable;           // open-addressing index of package names, -1
+	unsigned int hashsize;    // marks an empty slot; size is a power of two
+	struct owner *owners;     // all files sorted by path, built on demand
+	int numowners;
+	struct pkgidx_path *pathtable; // sorted path table of the binary index
+	int compact;              // some file lists are front-coded; there is
+	                          // no owner index then
+	size_t journalsize;       // bytes of complete records in the journal
+	struct stat generation;   // the on-disk database it was read from
 };
 
 /*
 	create_package: returns a struct package pointer from passed package
 		information: name, version, release number, file list, number
-		of files
+		of files; the package is copied into an arena of its own
 */
 
 struct package *create_package(char *name, char *version, int release, char **files, int numfiles);
 
 
+/*
+	parse_package_filename: splits the basename of a package file named
+		name#version-release.pkg.tar.<ext> into views stored in pn; returns
+		0, or -1 with a static description of the problem in error
+*/
+
+int parse_package_filename(char *filename, struct pkgname *pn, char **error);
+
+
+/*
+	package_block_size: returns the block size used to read package files
+*/
+
+size_t package_block_size();
+
+
+/*
+	open_package_archive: returns a libarchive reader opened on a package
+		file with every filter and format enabled, up to threads decoder
+		threads requested (0 for one per online CPU; pass 1 when several
+		archives are read at once), and the package block size; NULL if it
+		can't be opened
+*/
+
+struct archive *open_package_archive(char *filename, int threads);
+
+
+/*
+	read_package_archive: returns a struct package pointer with pertinent
+		information gathered from the passed filename, decoding it with up
+		to threads threads as with open_package_archive, or NULL with a
+		static description of the problem in error
+*/
+
+struct package *read_package_archive(char *filename, int threads, char **error);
+
+
 /*
 	create_package_from_archive: returns a struct package pointer with
-		pertinent information gathered from the passed filename
+		pertinent information gathered from the passed filename; exits if
+		the file can't be read
 */
 
 struct package *create_package_from_archive(char *filename);
 
 
 /*
-	free_package: frees memory used by a struct package pointer
+	free_package: frees memory used by a struct package pointer; packages
+		belonging to a packagedb are freed by free_packagedb instead
 */
 
 void free_package(struct package *pkg);
@@ -54,49 +158,213 @@ void free_package(struct package *pkg);
 
 /*
 	read_packagedb: returns a struct packagedb pointer with package
-		information read from the on-disk package database
+		information read from the on-disk package database and its journal;
+		the database is memory-mapped and the package strings point into
+		the mapping; exits if the database can't be read
 */
 
 struct packagedb *read_packagedb(char *pkgdb);
 
 
+/*
+	load_packagedb: reads the package database as read_packagedb does, but
+		returns NULL with a static description of the problem in error
+		instead of exiting; for long-running callers
+*/
+
+struct packagedb *load_packagedb(char *pkgdb, char **error);
+
+
 /*
 	free_packagedb: frees memory used by the package database struct
-		packagedb pointer
+		packagedb pointer and unmaps the on-disk database
 */
 
 void free_packagedb(struct packagedb *packagedb);
 
 
+/*
+	write_packagedb: writes packagedb to pkgdb in the package database
+		format, replacing the file atomically and syncing it to disk; the
+		journal it supersedes is sealed before and removed after; returns
+		0 on success or -1 if it could not be written
+*/
+
+int write_packagedb(struct packagedb *packagedb, char *pkgdb);
+
+
+/*
+	compact_packagedb: rebuilds the package database in a fresh arena with
+		every sorted file list front-coded, and releases the mapping and
+		indexes the old records used
+*/
+
+void compact_packagedb(struct packagedb *packagedb);
+
+
+/*
+	fileiter_init: positions it before the first file of pkg
+*/
+
+void fileiter_init(struct fileiter *it, struct package *pkg);
+
+
+/*
+	fileiter_next: returns the next file of the package, or NULL after the
+		last one; a front-coded path is only valid until the next call
+*/
+
+const char *fileiter_next(struct fileiter *it);
+
+
+/*
+	index_packagedb: (re)builds the package name hash index of the package
+		database; built on the first lookup, and needed again after
+		packages are added or removed
+*/
+
+void index_packagedb(struct packagedb *packagedb);
+
+
 /*
 	package_in_packagedb: returns the numeric index of a package in the
-		package database or -1 if not found
+		package database or -1 if not found; uses the name hash index,
+		building it if the database has none yet
 */
 
 int package_in_packagedb(char *pkgname, struct packagedb *packagedb);
 
 
 /*
-	list_files_in_package: prints a list of the files in a struct package
-		pointer
+	drop_indexes: frees the name and owner indexes of the package database
+		after packages were added or removed
 */
 
-void list_files_in_package(struct package *pkg);
+void drop_indexes(struct packagedb *packagedb);
 
 
 /*
-	list_file_owners: list owners of any files matching the passed regex,
-		if any
+	add_package_to_packagedb: adds pkg to the package database, in name
+		order; the database takes over the package and frees it with
+		itself, and its indexes are rebuilt when next needed
 */
 
-void list_file_owners(struct packagedb *packagedb, char *regex);
+void add_package_to_packagedb(struct packagedb *packagedb, struct package *pkg);
 
 
 /*
-	make_footprint: print the footprint of the passed package file
+	remove_package_from_packagedb: takes the package at index out of the
+		package database and returns it; it stays valid until it is freed
+		with free_package and the database with free_packagedb
 */
 
-void make_footprint(char *filename);
+struct package *remove_package_from_packagedb(struct packagedb *packagedb, int index);
+
+
+/*
+	list_package_in_packagedb: writes the files of the named package to
+		out while streaming through the on-disk package database, stopping at the
+		end of its record; returns 0, or -1 if the package is not found;
+		exits if the journal holds changes missing from the database
+*/
+
+int list_package_in_packagedb(char *pkgdb, char *pkgname, struct outbuf *out);
+
+
+/*
+	list_files_in_package: writes a list of the files in a struct package
+		pointer to out
+*/
+
+void list_files_in_package(struct package *pkg, struct outbuf *out);
+
+
+/*
+	index_owners: builds the owner index of the package database (every
+		file sorted by path) if it does not exist yet; compacted databases
+		have none
+*/
+
+void index_owners(struct packagedb *packagedb);
+
+
+/*
+	regex_literal_prefix: stores the literal prefix every match of an
+		extended regex anchored with '^' must start with into prefix and
+		returns its length, or -1 if the regex is not anchored or has an
+		alternation; complete is set to 1 if the regex is nothing but that
+		prefix, 2 if it is the prefix followed by '$', 0 otherwise
+*/
+
+int regex_literal_prefix(char *regex, char *prefix, size_t size, int *complete);
+
+
+/*
+	regex_literals: collects the longest literal strings that every match
+		of an extended regex contains into lit and returns their number;
+		returns 0 when nothing is certainly required, e.g. for a top-level
+		alternation
+*/
+
+int regex_literals(char *regex, struct literals *lit);
+
+
+/*
+	path_has_literals: returns 1 if '/' followed by path contains every
+		literal in lit, 0 if it cannot match the regex they came from
+*/
+
+int path_has_literals(const char *path, struct literals *lit);
+
+
+/*
+	list_file_owners: writes the owners of any files matching the passed
+		regex to out, if any; anchored literal prefixes are answered from
+		the owner index, other patterns are scanned by up to jobs threads
+		(0 for one per online CPU)
+*/
+
+void list_file_owners(struct packagedb *packagedb, char *regex, int jobs, struct outbuf *out);
+
+
+/*
+	make_footprint: writes the footprint of the passed package file to out
+		line by line while reading the archive; with sort set, the lines
+		are ordered by path using bounded in-memory runs and a merge;
+		threads is passed on to open_package_archive; returns 0, -1 if the archive could not be opened, or -2 if it
+		could not be read to the end
+*/
+
+int make_footprint(char *filename, struct outbuf *out, int sort, int threads);
+
+
+/*
+	make_footprints: makes the footprints of count package files with up
+		to jobs threads (0 for one per online CPU); each footprint is
+		written to <outdir>/<file>.footprint, or to out in input order,
+		with a '==> file <==' header when there are several; no worker
+		starts more than 2 * jobs footprints past the next one written, so
+		few wait in memory; returns the number of failed archives, or
+		count without writing anything if two archives share a name and
+		would be written to the same file in outdir
+*/
+
+int make_footprints(char **filenames, int count, char *outdir, int sort, int jobs, struct outbuf *out);
+
+
+/*
+	format_mode: stores the 10 character string representation of a
+		mode_t, plus a NUL, in out
+*/
+
+void format_mode(mode_t mode, char *out);
+
+
+/*
+	strhash: returns the 32-bit FNV-1a hash of a string
+*/
+
+unsigned int strhash(const char *s);
 
 
 /*
@@ -106,6 +374,31 @@ void make_footprint(char *filename);
 char *mtos(mode_t mode);
 
 
+/*
+	run_parallel: calls func(arg, item) for every item from 0 to count - 1
+		on up to jobs threads (0 for one per online CPU), the calling
+		thread included; items are handed out in order as threads free up
+*/
+
+void run_parallel(int jobs, int count, void (*func)(void *arg, int item), void *arg);
+
+
+/*
+	default_jobs: returns the number of online CPUs, the default number of
+		worker threads
+*/
+
+int default_jobs();
+
+
+/*
+	sync_parent_dir: syncs the directory holding path, making a file
+		created or renamed there durable; returns 0 on success or -1
+*/
+
+int sync_parent_dir(char *path);
+
+
 /*
 	print_version: prints the utility version
 */